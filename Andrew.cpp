@@ -3,36 +3,164 @@
 
 /*
  * Custom commands made (mostly) by Andrew :)
+ *
+ * Button presses on the camera are queued as timed steps and played out by
+ * processOutputs(), so a 9-second power press doesn't stop the rest of the
+ * system.  "planned" tracks what the camera will be doing once everything
+ * in the queue has run; "camera" is what it's doing now.
+ *
+ * MaintainAltitude() is a cascaded controller: altitude error sets a
+ * wanted vertical speed, and the speed error (plus an integral term) sets
+ * the duty of the ballast or vent output.  It runs once per fresh GPS fix
+ * on filtered altitude and vertical speed.  stepAltitudeControl() touches
+ * no hardware so it can be driven by a simulated balloon when tuning.
  */
 
 int SHUTTER_CONTROL = 30;
 int MODE_CONTROL = 33; // orig: 31;
 int PWR_CONTROL = 34; // orig: 32;
-boolean CameraPWRonORoff = false;
+static CameraInfo camera, planned;
 
+// One step of a button sequence: do something to a pin (or the state model), then wait
+enum { DRIVE, HIGH_LEVEL, LOW_LEVEL, FLOAT, POWER_TOGGLED, RECORDING_TOGGLED };
+struct CameraStep
+{
+  int pin;
+  int action;
+  unsigned long holdMs; // wait this long before the next step
+};
+
+#define CAMERA_QUEUE 16
+static const int PWR_STEPS = 4;     // what PressPWR() queues
+static const int SHUTTER_STEPS = 3; // what PressSHUTTER() queues
+static CameraStep steps[CAMERA_QUEUE];
+static int head = 0, count = 0;
+static unsigned long stepDue = 0;
+
+// Altitude control
+static AltitudeControlInfo control;
+static float gains[3] = {0.01, 0.3, 0.002}; // Kp (m/s per m), Kv (duty per m/s), Ki (duty per m*s)
+static const float FILTER_ALPHA = 0.5;     // alpha-beta filter on GPS altitude
+static const float FILTER_BETA = 0.1;
+static const float MAX_CLIMB = 2.0;        // m/s asked for, either direction
+static const float MAX_DUTY = 0.5;         // fraction of each fix interval a valve may be open
+static const unsigned long MIN_PULSE = 50;  // ms; shorter pulses don't move a valve
+static const int actuatorPins[2] = {ballastPin, ventPin};
+static bool pulsing[2];
+static unsigned long pulseEnd[2];
 
 // Declare functions used later in the file
 void PressPWR();
 void PressSHUTTER();
 
+// A sequence goes in whole or not at all: half of one could leave a pin driven
+static bool queueRoom(int needed, const char *what)
+{
+  if (count + needed <= CAMERA_QUEUE)
+    return true;
+  log(F("Camera queue full: %s rejected\r\n"), what);
+  return false;
+}
+
+static void queueStep(int pin, int action, unsigned long holdMs)
+{
+  if (count == CAMERA_QUEUE)
+  {
+    log(F("Camera queue full!\r\n"));
+    return;
+  }
+  steps[(head + count++) % CAMERA_QUEUE] = {pin, action, holdMs};
+}
+
+// Run whatever camera steps and valve pulse ends are due; never waits
+void processOutputs()
+{
+  for (int i=0; i<2; ++i)
+    if (pulsing[i] && (long)(millis() - pulseEnd[i]) >= 0)
+    {
+      digitalWrite(actuatorPins[i], LOW);
+      pulsing[i] = false;
+    }
+
+  while (count > 0 && (long)(millis() - stepDue) >= 0)
+  {
+    const CameraStep &step = steps[head];
+    switch (step.action)
+    {
+      case DRIVE:
+        pinMode(step.pin, OUTPUT); break;
+      case HIGH_LEVEL:
+        digitalWrite(step.pin, HIGH); break;
+      case LOW_LEVEL:
+        digitalWrite(step.pin, LOW); break;
+      case FLOAT:
+        pinMode(step.pin, INPUT); break;
+      case POWER_TOGGLED:
+        camera.powered = !camera.powered; break;
+      case RECORDING_TOGGLED:
+        camera.recording = !camera.recording; break;
+    }
+    stepDue = millis() + step.holdMs;
+    head = (head + 1) % CAMERA_QUEUE;
+    --count;
+  }
+  camera.busy = count > 0;
+}
+
+// How many ms until the next step is due (so sleep doesn't stretch a button press)
+unsigned long outputsDeadline()
+{
+  unsigned long deadline = 0xFFFFFFFFUL;
+  long wait;
+  if (count > 0)
+  {
+    wait = (long)(stepDue - millis());
+    deadline = wait <= 0 ? 0UL : (unsigned long)wait;
+  }
+  for (int i=0; i<2; ++i)
+    if (pulsing[i])
+    {
+      wait = (long)(pulseEnd[i] - millis());
+      if (wait <= 0)
+        deadline = 0UL;
+      else if ((unsigned long)wait < deadline)
+        deadline = wait;
+    }
+  return deadline;
+}
+
+const CameraInfo &getCameraInfo()
+{
+  return camera;
+}
+
 // This is called once at startup
 void AndrewsStartup()
 {
   // All the initial "pinMode" stuff goes here
+  startupBegin(STARTUP_OUTPUTS);
   log(F("Andrew's Startup\r\n"));
   pinMode(SHUTTER_CONTROL, INPUT);
   pinMode(MODE_CONTROL, OUTPUT);
   pinMode(PWR_CONTROL, INPUT);
+  for (int i=0; i<2; ++i)
+    if (actuatorPins[i] != -1)
+    {
+      pinMode(actuatorPins[i], OUTPUT);
+      digitalWrite(actuatorPins[i], LOW);
+    }
 
   // optional way to set initial settings
 
   char initialCmd[] = "C0,4;C1,15;C2,60;P200";
   executeRemoteCommand(initialCmd);
+  startupDone(STARTUP_OUTPUTS);
 }
 
 void BurstStart()
 {
   log(F("Burst Start\r\n"));
+  recorderTrigger(TRIGGER_CUTDOWN);
   /* TODO: maybe bring pin HIGH to burn filament? */
 }
 
@@ -42,10 +170,83 @@ void BurstEnd()
   /* TODO: return pin to floating? */
 }
 
+// One controller step: filter the new altitude and work out the valve duty (+ballast, -vent)
+void stepAltitudeControl(AltitudeControlInfo &c, const float k[3], float measured, float dt)
+{
+  float predicted = c.altitude + c.verticalSpeed * dt;
+  float residual = measured - predicted;
+  c.altitude = predicted + FILTER_ALPHA * residual;
+  c.verticalSpeed += FILTER_BETA * residual / dt;
+
+  c.wantedSpeed = constrain(k[0] * (c.target - c.altitude), -MAX_CLIMB, MAX_CLIMB);
+  float speedError = c.wantedSpeed - c.verticalSpeed;
+  float output = k[1] * speedError + k[2] * c.integral;
+
+  // Anti-windup: only integrate while the output isn't pinned against a limit
+  // (or when integrating would pull it back off the limit)
+  if ((output < MAX_DUTY || speedError < 0) && (output > -MAX_DUTY || speedError > 0))
+    c.integral += speedError * dt;
+  c.output = constrain(output, -MAX_DUTY, MAX_DUTY);
+}
+
 void MaintainAltitude(long target, long current)
 {
-  log(F("Maintain Altitude target = %ld, current = %ld\r\n"), target, current);
-  /* TODO */
+  static unsigned long lastFix = 0;
+  static unsigned long lastMillis = 0;
+  const GPSInfo &ginf = getGPSInfo();
+
+  // Act only on a fresh fix
+  if (ginf.staleFix || ginf.fixCount == lastFix)
+    return;
+  lastFix = ginf.fixCount;
+  unsigned long now = millis();
+  float dt = (now - lastMillis) / 1000.0f;
+  lastMillis = now;
+
+  // New target, or a long gap in fixes: start the filter over
+  if (!control.active || target != control.target || dt > 30.0f)
+  {
+    log(F("Maintain Altitude target = %ld, current = %ld\r\n"), target, current);
+    control.active = true;
+    control.target = target;
+    control.altitude = current;
+    control.verticalSpeed = 0.0;
+    control.integral = 0.0;
+    control.output = 0.0;
+    return;
+  }
+
+  stepAltitudeControl(control, gains, current, dt);
+
+  // Open the ballast or vent for a slice of the interval until the next fix
+  int which = control.output > 0 ? 0 : 1;
+  unsigned long pulse = (unsigned long)(fabsf(control.output) * dt * 1000.0f);
+  if (pulse >= MIN_PULSE && actuatorPins[which] != -1 && !pulsing[which])
+  {
+    digitalWrite(actuatorPins[which], HIGH);
+    pulseEnd[which] = now + pulse;
+    pulsing[which] = true;
+  }
+}
+
+void ReleaseAltitude()
+{
+  log(F("Altitude control off\r\n"));
+  control.active = false;
+}
+
+bool setAltitudeGain(int which, float value)
+{
+  if (which < 0 || which > 2)
+    return false;
+  gains[which] = value;
+  log(F("Altitude gains Kp=%.4f Kv=%.4f Ki=%.4f\r\n"), gains[0], gains[1], gains[2]);
+  return true;
+}
+
+const AltitudeControlInfo &getAltitudeControlInfo()
+{
+  return control;
 }
 
 void TakePicture()
@@ -57,15 +258,26 @@ void TakePicture()
 void VideoStart()
 {
   log(F("Start Video\r\n"));
-  if (CameraPWRonORoff == false)  PressPWR();
+  if (planned.recording)
+    return;
+  if (!queueRoom((planned.powered ? 0 : PWR_STEPS) + SHUTTER_STEPS + 1, "video start"))
+    return;
+  if (planned.powered == false)  PressPWR();
   PressSHUTTER();
-  delay(2000);
+  queueStep(-1, RECORDING_TOGGLED, 2000);
+  planned.recording = true;
 }
 
 void VideoEnd()
 {
   log(F("End Video\r\n"));
-  /* TODO */
+  if (!planned.recording)
+    return;
+  if (!queueRoom(SHUTTER_STEPS + 1, "video end"))
+    return;
+  PressSHUTTER();
+  queueStep(-1, RECORDING_TOGGLED, 0);
+  planned.recording = false;
 }
 
 void Macro(int n)
@@ -74,24 +286,29 @@ void Macro(int n)
   /* TODO */
 }
 
-void PressPWR()
+bool cameraIsOn()
 {
-  pinMode(PWR_CONTROL, OUTPUT);
-  delay(2000);
-  digitalWrite(PWR_CONTROL, HIGH);
-  delay(4000);
-  pinMode(PWR_CONTROL, INPUT);
-  CameraPWRonORoff = !CameraPWRonORoff;
+  return camera.powered;
+}
 
-  delay(3000);
+void PressPWR()
+{
+  if (!queueRoom(PWR_STEPS, "power press"))
+    return;
+  queueStep(PWR_CONTROL, DRIVE, 2000);
+  queueStep(PWR_CONTROL, HIGH_LEVEL, 4000);
+  queueStep(PWR_CONTROL, FLOAT, 0);
+  queueStep(-1, POWER_TOGGLED, 3000);
+  planned.powered = !planned.powered;
 }
 
 void PressSHUTTER()
 {
-  pinMode(SHUTTER_CONTROL, OUTPUT);
-  digitalWrite(SHUTTER_CONTROL, LOW); // bring to ground
-  delay(250); //
+  if (!queueRoom(SHUTTER_STEPS, "shutter press"))
+    return;
+  queueStep(SHUTTER_CONTROL, DRIVE, 0);
+  queueStep(SHUTTER_CONTROL, LOW_LEVEL, 250); // bring to ground
   // then return to floating:
-  pinMode(SHUTTER_CONTROL, INPUT);
+  queueStep(SHUTTER_CONTROL, FLOAT, 0);
 }
 
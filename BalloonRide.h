@@ -11,15 +11,20 @@ typedef const __FlashStringHelper *FlashString;
 static const unsigned long gpsBaud = 9600UL;
 static const unsigned long rockBLOCKBaud = 19200UL;
 static const unsigned long consoleBaud = 115200UL;
-static const int THERMAL_PROBES = 2;
+static const int THERMAL_BUSES = 2;       // 1-Wire buses (one pin each)
+static const int MAX_THERMAL_PROBES = 8;  // total probes across all buses
+static const float BATTERY_CAPACITY_MAH = 3400.0; // rated capacity of the main (1S Li-ion) battery
+static const float DEFAULT_LOAD_MA = 80.0;        // assumed average draw until something better is known
+static const float MISSION_HOURS = 240.0;         // how long the battery has to last
+static const int THERMAL_RESOLUTION = 12; // DS18B20 bits (9-12): 94 ms conversion at 9 bits, 750 ms at 12
 #define PROGRAMNAME "BalloonRide"
 #define VERSION "7.00"
 #define COPYRIGHT "Copyright (C) 2015-9 International Circumnavigating Balloon Consortium"
 #define SMALLCOPYRIGHT "(C) 2015-9 ICBC"
-static const double INVALID_VOLTAGE = -1000.0;
-static const double INVALID_TEMPERATURE = -1000.0;
+static const float INVALID_VOLTAGE = -1000.0;
+static const float INVALID_TEMPERATURE = -1000.0;
 static const long INVALID_ALTITUDE = -20000L;
-static const double INVALID_LATLONG = -1000.0;
+static const long INVALID_LATLONG = -2000000000L; // in 1e-7 degrees
 typedef enum { LOG_IRIDIUM = 1, LOG_TELEMETRY = 2, LOG_RUNLOG = 4 } LOGTYPE;
 
 // Port mappings and pin assigments
@@ -37,11 +42,15 @@ static const int gpsFixPin = -1;
 static const int gpsPPSPin = -1;
 static const int gpsBackupBatteryVoltagePin = A1;
 static const int mainBatteryVoltagePin = A0;
+static const int adcVrefPin = 39;    // VREF module output, 1.195V (Teensy 3.2 core numbering)
 static const int rockBLOCKSleepPin = 4;
 static const int rockBLOCKRingPin = 5;
 static const int gpsPowerPin = -1;
 static const int ds18B20pin0 = 11;
 static const int ds18B20pin1 = 12;
+static const int ballastPin = -1;
+static const int ventPin = -1;
+static const int consoleRxPin = -1; // USB console cannot wake us
 #else
 typedef HardwareSerial ConsoleType;
 #define ConsoleSerial Serial5
@@ -52,17 +61,32 @@ static const int gpsFixPin = 2;
 static const int gpsPPSPin = 4;
 static const int gpsBackupBatteryVoltagePin = -1;
 static const int mainBatteryVoltagePin = A9;
+static const int adcVrefPin = 71;    // VREF module output, 1.195V (Teensy 3.5 core numbering)
 static const int rockBLOCKSleepPin = 12;
 static const int rockBLOCKRingPin = 11;
 static const int gpsPowerPin = 3;
 static const int ds18B20pin0 = 28;
 static const int ds18B20pin1 = 30;
+static const int ballastPin = -1;   // altitude control outputs (not yet wired)
+static const int ventPin = -1;
+static const int consoleRxPin = 34; // Serial5 RX, for waking from deep sleep
 #endif
 // Pin assignments
 // GPS connected to Serial2 (pins 9 and 10) (PCB is Serial3 -- pins 7 and 8)
 // RockBLOCK connected to Serial3 (pins 7 and 8) (PCB is Serial2 -- pins 9 and 10)
 // FTDI connected (via external board) to Serial5 (pins 33 and 34)
 
+// Modelled current draw of each load (mA), for the power governor
+static const float CPU_MA = 40.0;
+static const float GPS_MA = 25.0;
+static const float MODEM_IDLE_MA = 35.0;
+static const float MODEM_TX_MA = 150.0;   // averaged over a session, peaks are much higher
+static const float DISPLAY_ON_MA = 15.0;  // with charge pump running
+static const float CAMERA_MA = 250.0;
+
+// EEPROM layout
+static const int EEPROM_PROBE_MAP = 0;    // thermal probe map (magic, count, bus + ROM per probe)
+
 // Error "blink" codes
 static const int BALLOON_ERR_IRIDIUM_INIT = 2;
 static const int BALLOON_ERR_SD_INIT = 3;
@@ -74,14 +98,26 @@ struct GPSInfo
 {
    int year;
    byte month, day, hour, minute, second, hundredths;
-   double latitude = INVALID_LATLONG, longitude = INVALID_LATLONG;
+   long latitude = INVALID_LATLONG, longitude = INVALID_LATLONG; // in 1e-7 degrees
    long altitude = INVALID_ALTITUDE; // in meters
-   double course, speed; // degrees, knots
+   float course, speed; // degrees, knots
+   float verticalSpeed; // m/s, smoothed over a few fixes
    int satellites;
    bool fixAcquired;
    bool staleFix;
    long age;
    unsigned long checksumFail;
+   unsigned long fixCount;        // bumped on every new location
+   unsigned long trackDistance;   // meters along the ground track since boot
+};
+
+// Running total of the distance between successive positions, in whole
+// meters so a long flight doesn't swallow 20 m steps in float rounding
+struct Odometer
+{
+  long lat = INVALID_LATLONG, lng = INVALID_LATLONG; // last position counted
+  unsigned long meters = 0;
+  float fraction = 0;            // of a meter, not yet counted
 };
 
 struct IridiumInfo
@@ -100,7 +136,7 @@ struct IridiumInfo
 
   // Primary messages (location, altitude, battery, internal temperature)
   time_t xmitTime1;   // system time of last transmission
-  double lat, lng;           // location at last transmission
+  long lat, lng;             // location at last transmission (1e-7 degrees)
   long alt;                  // altitude at last transmission
   char transmitBuffer1[128]; // most recent primary transmit string
 
@@ -112,6 +148,7 @@ struct IridiumInfo
   unsigned long count;           // number of successful transmissions
   unsigned long failcount;       // number of unsuccessful transmissions
   bool isTransmitting;           // true if in the middle of transmission
+  bool isAwake;                  // true unless the modem has been put to sleep
   char receiveBuffer[128];       // most recent receive buffer
   int rxMessageNumber = 0;       // count of successful receptions
 };
@@ -121,21 +158,142 @@ struct BalloonInfo
   enum {ONGROUND=0, INFLIGHT, LANDED};
   int flightState = ONGROUND;    // ONGROUND, INFLIGHT, or LANDED
   bool isDescending;             // true if balloon descending
-  double lateralTravel;          // meters traveled since last transmit
+  float lateralTravel;          // meters traveled since last transmit
   unsigned long verticalTravel;  // meters traveled vertically since last transmit
   long groundAltitude = INVALID_ALTITUDE;
   long maxAltitude = INVALID_ALTITUDE;
 };
 
+struct LandingInfo
+{
+  bool valid;                    // descending, and so predicting
+  long latitude, longitude;      // predicted landing point, 1e-7 degrees
+  float timeToGround;            // seconds
+  float seaLevelRate = 5.0;      // m/s the parachute would fall at sea level
+};
+
 struct ThermalInfo
 {
-   double temperature[THERMAL_PROBES];
+   int probeCount;                           // 0 is internal, 1 is external, then any extras
+   float temperature[MAX_THERMAL_PROBES];
 };
 
 struct BatteryInfo
 {
-   double batteryVoltage;
-   double gpsBackupBatteryVoltage;
+   float batteryVoltage;
+   float gpsBackupBatteryVoltage;
+   float stateOfCharge;   // percent, from the discharge curve (-1 if unknown)
+   float remainingMah;    // usable charge left at the current temperature
+   float remainingHours;  // at the current load
+};
+
+struct CameraInfo
+{
+  enum { VIDEO=0, PHOTO };
+  bool powered;
+  bool recording;
+  int mode = VIDEO;              // MODE_CONTROL isn't driven yet, so always VIDEO
+  bool busy;                     // true while a button sequence is playing out
+};
+
+struct AltitudeControlInfo
+{
+  bool active;
+  long target;                   // meters
+  float altitude;               // filtered, meters
+  float verticalSpeed;          // filtered, m/s
+  float wantedSpeed;            // m/s asked of the inner loop
+  float integral;               // accumulated speed error, m
+  float output;                 // valve duty: + ballast, - vent
+};
+
+struct PowerInfo
+{
+  enum { LOAD_CPU=0, LOAD_GPS, LOAD_MODEM, LOAD_DISPLAY, LOAD_CAMERA, LOAD_COUNT };
+  enum { FULL=0, NO_SECONDARY, NO_DISPLAY, FEWER_PICTURES, GPS_DUTY_CYCLE }; // throttle levels
+  int level = FULL;
+  float loadMa;                  // modelled draw right now
+  float averageLoadMa;           // smoothed over ~10 minutes
+  float consumedMah[LOAD_COUNT]; // modelled consumption of each load since boot
+};
+
+struct ModeProfile
+{
+  enum { NORMAL=0, ALERT, NORWAY, AUTO };
+  const char *name;
+  time_t gpsOffSeconds;          // GPS off time between fixes (0 = always on)
+  bool listenForRing;            // keep the modem awake between sessions to hear RING
+  uint16_t minPrimaryInterval;   // minutes; primaries no more often than this unless requested
+  time_t logInterval;            // seconds between telemetry records
+  bool displayAllowed;
+  time_t sleepTick;              // seconds; longest the CPU sleeps between passes
+};
+
+// One consistent record of everything the consumers report (see Telemetry.cpp)
+struct Telemetry
+{
+  uint32_t sequence;             // bumped on every publish; 0 until the first
+  time_t time;                   // mission time it was taken
+  GPSInfo gps;
+  BatteryInfo battery;
+  ThermalInfo thermal;
+  BalloonInfo balloon;
+  LandingInfo landing;
+  struct
+  {
+    unsigned long count, failcount;
+    time_t xmitTime1;
+    bool isTransmitting;
+  } iridium;                     // just the modem's counters, not its buffers
+};
+
+// Count, range, mean and variance of a stream of values in O(1) memory (Welford)
+struct Statistic
+{
+  unsigned long count;
+  float min, max, mean;
+  float m2;                      // sum of squared differences from the mean
+  void add(float x);
+  void merge(const Statistic &other);
+  float variance() const { return count > 1 ? m2 / (count - 1) : 0.0f; }
+};
+
+// What happened over one reporting interval (see Statistics.cpp)
+struct IntervalStats
+{
+  unsigned long samples;         // telemetry snapshots seen
+  Statistic temperature[2];      // internal, external
+  Statistic battery;
+  Statistic altitude, speed, satellites; // fixes only
+  float courseX, courseY;        // sums of velocity, for the mean course
+};
+
+// Builds text in a caller's buffer without printf (see Format.cpp).  Like
+// snprintf, output is always NUL-terminated and is cut short if it won't fit.
+class TextWriter
+{
+public:
+  template<size_t N> TextWriter(char (&buffer)[N]) : buf(buffer), size(N), len(0) { buf[0] = '\0'; }
+  TextWriter(char *buffer, size_t n) : buf(buffer), size(n), len(0) { if (n > 0) buf[0] = '\0'; }
+
+  TextWriter &text(const char *s);
+  TextWriter &text(char c);
+  template<typename T> TextWriter &number(T n, int width = 0, char pad = ' ')
+  {
+    return n < 0 ? digits(0UL - (unsigned long)n, true, width, pad) : digits((unsigned long)n, false, width, pad);
+  }
+  TextWriter &fixed(float value, int decimals);
+  TextWriter &fixed(long value, int places, int decimals);
+  TextWriter &coordinate(long e7, int decimals);
+  TextWriter &timestamp(int year, int month, int day, int hour, int minute, int second);
+  TextWriter &statistic(const Statistic &s, int decimals);
+  size_t length() const { return len; }
+
+private:
+  TextWriter &digits(unsigned long magnitude, bool negative, int width, char pad);
+  TextWriter &fixedDigits(uint32_t whole, uint32_t fraction, bool negative, int decimals);
+  char *buf;
+  size_t size, len;
 };
 
 // Function prototypes
@@ -145,16 +303,36 @@ extern void AndrewsStartup();
 extern void BurstStart();
 extern void BurstEnd();
 extern void MaintainAltitude(long target, long current);
+extern void ReleaseAltitude();
+extern void stepAltitudeControl(AltitudeControlInfo &c, const float k[3], float measured, float dt);
+extern bool setAltitudeGain(int which, float value);
+extern const AltitudeControlInfo &getAltitudeControlInfo();
 extern void TakePicture();
 extern void VideoStart();
 extern void VideoEnd();
 extern void Macro(int n);
+extern bool cameraIsOn();
+extern void processOutputs();
+extern unsigned long outputsDeadline();
+extern const CameraInfo &getCameraInfo();
 
 /* Battery */
 extern void startBatteryMonitor();
 extern void processBatteryData();
+extern void setBatteryLoad(float milliamps);
 extern const BatteryInfo &getBatteryInfo();
 
+/* BlackBox */
+enum { TRACE_BOOT, TRACE_SLOW, TRACE_IRIDIUM, TRACE_COMMAND, TRACE_CONSOLE, TRACE_SCHEDULED,
+  TRACE_FAULT, TRACE_RESTART, TRACE_RECOVERED, TRACE_MODE, TRACE_CAPTURE };
+enum { TRACE_IRIDIUM_BEGIN, TRACE_IRIDIUM_SENDRECEIVE, TRACE_IRIDIUM_SLEEP };
+extern void startBlackBox();
+extern void trace(uint8_t type, uint8_t code = 0, int32_t value = 0);
+extern void traceWhere(int section, bool nested);
+extern const char *resetReport();
+extern void resetReported();
+extern void showBlackBox();
+
 /* Commands */
 extern bool executeConsoleCommand(char *cmd);
 extern bool executeRemoteCommand(char *cmd);
@@ -164,27 +342,52 @@ extern void processScheduler();
 /* Console */
 extern void startConsole();
 extern void processConsole();
-extern void consoleText(const char *str);
-extern void consoleText(int n);
-extern void consoleText(char c);
-extern void consoleText(FlashString fs);
+extern int consoleRoom();
+extern void consoleWrite(const uint8_t *data, int length);
+extern bool consoleBusy();
+extern void showConsoleStats();
+extern void consoleText(const char *str, uint8_t channel = 0);
+extern void consoleText(int n, uint8_t channel = 0);
+extern void consoleText(char c, uint8_t channel = 0);
+extern void consoleText(FlashString fs, uint8_t channel = 0);
 extern uint8_t getConsoleViewFlags();
 extern void setConsoleViewFlags(uint8_t flags);
 
 /* Display */
 extern void startDisplay();
 extern void processDisplay();
+extern void serviceDisplay();
+extern bool displayBusy();
+extern void wakeDisplay(const char *reason);
+extern bool displayIsOn();
 extern void displayText(const char *str);
 extern void displayText(int n);
 extern void displayText(FlashString fs);
 
+/* Geodesy */
+extern float distanceBetween(long lat1, long lng1, long lat2, long lng2);
+extern float courseTo(long lat1, long lng1, long lat2, long lng2);
+extern void movePosition(long &lat, long &lng, float east, float north);
+extern void addToOdometer(Odometer &odo, long lat, long lng, float minStep);
+extern void benchmarkGeodesy();
+
 /* GPS */
 extern void gpsOff();
 extern void gpsOn();
+extern bool gpsIsOn();
+extern void setGPSFastFixes(bool fast);
 extern void startGPS();
 extern void processGPS();
 extern const GPSInfo &getGPSInfo();
 
+/* GroundLink */
+extern void startGroundLink();
+extern bool groundLinkActive();
+extern void groundLinkByte(uint8_t c);
+extern void groundLinkText(const char *str);
+extern void processGroundLink();
+extern void sendFrame(uint8_t type, uint8_t sequence, const void *payload, int length);
+
 /* Iridium */
 extern void startIridium();
 extern void processIridium();
@@ -203,6 +406,11 @@ extern void startLED();
 extern void processLED();
 extern void blink(int count);
 
+/* Landing */
+extern void processLanding();
+extern const LandingInfo &getLandingInfo();
+extern void showLanding();
+
 /* Logging */
 extern void startLogs();
 extern void processLogs();
@@ -211,17 +419,95 @@ extern void log(FlashString fmt, ...);
 extern void log(char c);
 extern void iridiumLog(char c);
 extern void showLog(LOGTYPE whichLog);
+extern int readLogBlock(LOGTYPE whichLog, uint32_t offset, uint8_t *dest, int length, uint32_t *size);
 extern bool SDFail();
 
+/* Memory */
+enum { STACK_SETUP, STACK_LOOP, STACK_NESTED, STACK_CONTEXTS };
+extern void paintStack();
+extern void stackEntry(int context);
+extern void stackCheck(int context);
+extern void showMemory();
+
+/* Power */
+extern void startPower();
+extern void processPower();
+extern bool powerThrottled(int level);
+extern void showPower();
+extern const PowerInfo &getPowerInfo();
+
+/* Profiler */
+enum { PROFILE_GPS, PROFILE_THERMAL, PROFILE_BATTERY, PROFILE_POWER, PROFILE_LOGS, PROFILE_IRIDIUM,
+  PROFILE_LED, PROFILE_DISPLAY, PROFILE_CONSOLE, PROFILE_SCHEDULER, PROFILE_OUTPUTS, PROFILE_RECORDER, PROFILE_COUNT };
+extern void startProfiler();
+extern void profileStart();
+extern void profileMark(int section);
+extern void profileEnd();
+extern void showProfile();
+extern void resetProfile();
+extern uint32_t profilePasses();
+extern uint32_t profileAverage(int section);
+extern uint32_t profileWorst(int section);
+extern const char *profileSectionName(int section);
+
+/* Recorder */
+enum { TRIGGER_MANUAL, TRIGGER_CUTDOWN, TRIGGER_BURST, TRIGGER_DESCENT, TRIGGER_LANDING, TRIGGER_COUNT };
+extern void processRecorder();
+extern void recorderTrigger(int trigger);
+extern void showRecorder();
+
 /* Sleep */
 extern void startSleep();
 extern void startClocks();
 extern void processSleep();
+extern void showSleepStats();
+extern bool setPowerMode(int mode);
+extern int getPowerMode();
+extern const ModeProfile &getModeProfile();
 extern time_t getMissionTime();
 
+/* Startup */
+enum { STARTUP_SETUP, STARTUP_DISPLAY, STARTUP_LOGS, STARTUP_THERMAL, STARTUP_BATTERY, STARTUP_GPS,
+  STARTUP_IRIDIUM, STARTUP_OUTPUTS, STARTUP_TELEMETRY, STARTUP_COUNT };
+extern void startupBegin(int which);
+extern void startupDone(int which, bool ok = true);
+extern bool subsystemReady(int which);
+extern bool startupComplete();
+extern void showStartup();
+
+/* Statistics */
+enum { INTERVAL_SECONDARY, INTERVAL_LOG, INTERVAL_COUNT };
+extern void processStatistics();
+extern const IntervalStats &getIntervalStats(int which);
+extern float meanCourse(const IntervalStats &s);
+extern void resetIntervalStats(int which);
+extern void mergeIntervalStats(int which, const IntervalStats &earlier);
+
+/* Supervisor */
+enum { SUPERVISE_GPS, SUPERVISE_LOGS, SUPERVISE_IRIDIUM, SUPERVISE_COUNT };
+enum { HEALTH_STARTING, HEALTH_OK, HEALTH_DEGRADED, HEALTH_DOWN };
+extern void startSupervisor();
+extern void processSupervisor();
+extern void feedWatchdog();
+extern void supervisorCheckIn(int which);
+extern void reportHealthy(int which);
+extern void reportDegraded(int which, const char *why);
+extern void reportFault(int which, const char *why);
+extern bool restartDue(int which);
+extern int getHealth(int which);
+extern const char *supervisedName(int which);
+extern void showSupervisor();
+
+/* Telemetry */
+extern void publishTelemetry(bool nested);
+extern const Telemetry &getTelemetry();
+
 /* Thermo */
 extern void startThermalProbes();
+extern void showThermalProbes();
+extern void rescanThermalProbes();
 extern void processThermalData();
+extern unsigned long thermalDeadline();
 extern const ThermalInfo &getThermalInfo();
 
 /* Utilities */
@@ -14,8 +14,13 @@
 static bool IridiumReentrant = false;
 static bool setupComplete = false;
 
+// Nothing in here waits on a peripheral: GPS detection and the modem's
+// handshake finish from loop(), and report in through startupDone()
 void setup()
 {
+  paintStack();
+  startupBegin(STARTUP_SETUP);
+
   // Set up system and mission timers
   startClocks();
 
@@ -25,6 +30,18 @@ void setup()
   // Start the console port
   startConsole();
 
+  // Set up the OLED display
+  startDisplay();
+
+  // Open SD log files, so everything from here on is in the run log
+  startLogs();
+
+  // Whatever the last run left in the black box goes to SD
+  startBlackBox();
+
+  // Watchdog, from here on
+  startSupervisor();
+
   // Greeting
   log(PROGRAMNAME " " VERSION "\r\n");
   log(COPYRIGHT "\r\n");
@@ -32,12 +49,6 @@ void setup()
   log("\r\n");
   showCommands();
 
-  // Set up the OLED display
-  startDisplay();
-
-  // Open SD log files
-  startLogs();
-
   // Start up the thermal probes
   startThermalProbes();
 
@@ -53,26 +64,57 @@ void setup()
   // Andrew
   AndrewsStartup();
 
+  // Power governor
+  startPower();
+
   // Sleep
   startSleep();
+
+  // Loop profiler
+  startProfiler();
   
   // All done with initialization!
   setupComplete = true;
+  stackCheck(STACK_SETUP);
+  startupDone(STARTUP_SETUP);
 }
 
 void loop()
 {
+  profileStart();
   processGPS();
+  processLanding();
+  profileMark(PROFILE_GPS);
   processThermalData();
+  profileMark(PROFILE_THERMAL);
   processBatteryData();
+  profileMark(PROFILE_BATTERY);
+  processPower();
+  publishTelemetry(IridiumReentrant);
+  processStatistics();
+  profileMark(PROFILE_POWER);
   processLogs();
+  profileMark(PROFILE_LOGS);
   if (!IridiumReentrant)
     processIridium();
+  profileMark(PROFILE_IRIDIUM);
   processLED();
+  profileMark(PROFILE_LED);
   processDisplay();
+  serviceDisplay();
+  profileMark(PROFILE_DISPLAY);
   processConsole();
+  profileMark(PROFILE_CONSOLE);
   processScheduler();
-  //processSleep();
+  processSupervisor();
+  profileMark(PROFILE_SCHEDULER);
+  processOutputs();
+  profileMark(PROFILE_OUTPUTS);
+  processRecorder();
+  profileMark(PROFILE_RECORDER);
+  profileEnd();
+  if (!IridiumReentrant)
+    processSleep();
 }
 
 // Recursively call loop during lengthy Iridium operations!
@@ -3,28 +3,155 @@
 
 /*
  * Handle the main battery and GPS backup battery
+ *
+ * The main battery is sampled on every pass through the loop (at most ten
+ * times a second) using the ADC's hardware averaging, corrected against
+ * the chip's 1.195V VREF module (so a sagging 3.3V rail doesn't skew the
+ * reading) and smoothed.  Once a second the smoothed voltage is run
+ * through a Li-ion discharge curve, derated for cold, to estimate the
+ * charge remaining and how long it will last at the present load.
  */
 
 static BatteryInfo info;
+
+static const int ADC_BITS = 12;
+static const float ADC_FULL_SCALE = 4096.0;
+static const float NOMINAL_VREF = 3.3;     // volts, if the VREF reading looks wrong
+static const float VREF_VOLTS = 1.195;     // K64 VREF module output, on ADC1_SE18
+static const float DIVIDER = 2.0;          // resistor divider on mainBatteryVoltagePin
+static const unsigned long SAMPLE_INTERVAL = 100UL; // ms
+static const float SMOOTHING = 0.1;        // weight given to each new sample
+
+struct CurvePoint
+{
+  float x, y;
+};
+
+// Open-circuit voltage vs. state of charge (%) for one Li-ion cell at 25C
+static const CurvePoint dischargeCurve[] =
+{
+  {3.30, 0}, {3.50, 5}, {3.61, 10}, {3.67, 20}, {3.71, 30}, {3.75, 40},
+  {3.79, 50}, {3.85, 60}, {3.92, 70}, {4.00, 80}, {4.10, 90}, {4.20, 100}
+};
+
+// Fraction of rated capacity that can actually be drawn at a given temperature
+static const CurvePoint coldDerating[] =
+{
+  {-40, 0.30}, {-20, 0.60}, {0, 0.85}, {25, 1.00}
+};
+
+static float smoothedVoltage = INVALID_VOLTAGE;
+static float vref = NOMINAL_VREF;
+static float loadMa = DEFAULT_LOAD_MA;
+
+// Piecewise-linear lookup in a table sorted by x
+static float interpolate(const CurvePoint *table, int n, float x)
+{
+  if (x <= table[0].x)
+    return table[0].y;
+  for (int i=1; i<n; ++i)
+    if (x <= table[i].x)
+      return table[i-1].y + (table[i].y - table[i-1].y) * (x - table[i-1].x) / (table[i].x - table[i-1].x);
+  return table[n-1].y;
+}
+
 void startBatteryMonitor()
 {
+  startupBegin(STARTUP_BATTERY);
   info.batteryVoltage = INVALID_VOLTAGE;
   info.gpsBackupBatteryVoltage = INVALID_VOLTAGE;
+  info.stateOfCharge = -1.0;
+  info.remainingMah = -1.0;
+  info.remainingHours = -1.0;
+
+  analogReadResolution(ADC_BITS);
+  analogReadAveraging(32); // hardware averaging inside the ADC
+  // Start the VREF module (keeping its factory trim), so adcVrefPin has something to read
+  SIM_SCGC4 |= SIM_SCGC4_VREF;
+  VREF_TRM |= VREF_TRM_CHOPEN;
+  VREF_SC = VREF_SC_VREFEN | VREF_SC_REGEN | VREF_SC_ICOMPEN | VREF_SC_MODE_LV(1);
+  startupDone(STARTUP_BATTERY);
+}
+
+// Measure the actual ADC reference against VREF
+static void calibrate()
+{
+  static bool reported = false;
+  static int failures = 0;
+  int raw = analogRead(adcVrefPin);
+  float measured = raw > 0 ? VREF_VOLTS * ADC_FULL_SCALE / raw : 0.0f;
+  bool good = measured > 2.8f && measured < 3.6f;
+  if (good)
+    vref = measured;
+  // Say once how it went, allowing VREF a few seconds to settle
+  if (!reported && (good || ++failures >= 10))
+  {
+    reported = true;
+    if (good)
+      log(F("Battery: ADC reference measured at %.3fV\r\n"), measured);
+    else
+      log(F("Battery: ADC reference calibration failed (VREF read %d): assuming %.1fV\r\n"), raw, NOMINAL_VREF);
+  }
+}
+
+static void sample()
+{
+  float v = DIVIDER * vref * analogRead(mainBatteryVoltagePin) / ADC_FULL_SCALE;
+
+  // Don't let the voltage sag during a satellite session drag the model down
+  if (getIridiumInfo().isTransmitting && smoothedVoltage != INVALID_VOLTAGE)
+    return;
+
+  smoothedVoltage = smoothedVoltage == INVALID_VOLTAGE ? v : smoothedVoltage + SMOOTHING * (v - smoothedVoltage);
+}
+
+static void updateModel()
+{
+  const int curvePoints = sizeof dischargeCurve / sizeof *dischargeCurve;
+  const int deratePoints = sizeof coldDerating / sizeof *coldDerating;
+
+  if (smoothedVoltage == INVALID_VOLTAGE)
+    return;
+
+  // The battery lives inside the payload with the internal probe
+  float celsius = getThermalInfo().temperature[0];
+  if (celsius == INVALID_TEMPERATURE)
+    celsius = 25.0;
+
+  info.stateOfCharge = interpolate(dischargeCurve, curvePoints, smoothedVoltage);
+  info.remainingMah = BATTERY_CAPACITY_MAH * interpolate(coldDerating, deratePoints, celsius) * info.stateOfCharge / 100.0f;
+  info.remainingHours = loadMa > 0 ? info.remainingMah / loadMa : -1.0f;
 }
 
 void processBatteryData()
 {
-  static time_t lastTimeActive = 0; // only really do this once per second
+  static unsigned long lastSampleTime = 0UL;
+  static time_t lastTimeActive = 0; // only update the model once per second
+
+  if (lastSampleTime == 0UL || millis() - lastSampleTime >= SAMPLE_INTERVAL)
+  {
+    lastSampleTime = millis();
+    sample();
+  }
+
   if (lastTimeActive == 0 || getMissionTime() != lastTimeActive)
   {
     lastTimeActive = getMissionTime();
-    info.batteryVoltage = 2.0 * 3.3 * analogRead(mainBatteryVoltagePin) / 1024.0;
-    info.gpsBackupBatteryVoltage = 5.0 * analogRead(gpsBackupBatteryVoltagePin) / 1024.0;
+    calibrate();
+    info.batteryVoltage = smoothedVoltage;
+    if (gpsBackupBatteryVoltagePin != -1)
+      info.gpsBackupBatteryVoltage = 5.0f / NOMINAL_VREF * vref * analogRead(gpsBackupBatteryVoltagePin) / ADC_FULL_SCALE;
+    updateModel();
   }
 }
 
+// Tell the model how much current the system is drawing right now
+void setBatteryLoad(float milliamps)
+{
+  loadMa = milliamps;
+}
+
 const BatteryInfo &getBatteryInfo()
 {
   return info;
-}
-
+}
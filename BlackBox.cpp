@@ -0,0 +1,281 @@
+#include <Arduino.h>
+#include <SdFat.h>
+#include "BalloonRide.h"
+
+/*
+ * Black box: a trace of recent events that survives a reset
+ *
+ * The ring lives in .noinit RAM, which the startup code leaves alone, so
+ * after a watchdog reset, a brown-out or a crash the previous run's last
+ * TRACE_EVENTS events are still there.  Events are only the rare,
+ * interesting things: Iridium return codes, commands, supervisor
+ * decisions, mode changes, and loop sections that ran long.  Recording one
+ * is a dozen stores, cheap enough to leave on.  The profiler also notes which
+ * loop section is running, without using the ring.
+ *
+ * A fault handler saves the stacked registers and the fault status
+ * registers, then resets.  So does the watchdog's early-warning interrupt,
+ * which shows where we were stuck.  At the next boot startBlackBox() writes
+ * all of it to blackbox.log in the new run directory and logs a summary.
+ * The summary also rides along on the next primary Iridium message.
+ */
+
+static const uint32_t BOX_MAGIC = 0xB1AC0B0CUL;
+static const uint32_t FAULT_MAGIC = 0xFA017ED0UL;
+static const int TRACE_EVENTS = 128;
+static const uint8_t NOWHERE = 0xFF;
+
+struct TraceEvent
+{
+  uint32_t ms;
+  int32_t value;
+  uint8_t type, code;
+};
+
+static struct
+{
+  uint32_t magic;
+  uint16_t head, count;
+  uint32_t boots;
+  uint8_t where, nested;             // loop section running: outer pass and, during Iridium, inner pass
+  TraceEvent events[TRACE_EVENTS];
+  struct
+  {
+    uint32_t magic;
+    uint8_t kind, where, nested;
+    uint32_t ms;
+    uint32_t r0, r1, r2, r3, r12, lr, pc, psr; // as stacked on exception entry
+    uint32_t sp, cfsr, hfsr, mmfar, bfar;
+  } fault;
+} box __attribute__((section(".noinit")));
+
+static bool ready = false;
+static char resetSummary[48] = "";
+
+static const char *traceNames[] =
+  {"boot", "slow section", "Iridium", "command", "console", "scheduled", "fault", "restart", "recovered", "mode", "capture"};
+static const char *iridiumOps[] = {"begin", "sendReceive", "sleep"};
+enum { FAULT_HARD, FAULT_WATCHDOG };
+static const char *faultNames[] = {"fault", "watchdog"};
+
+void trace(uint8_t type, uint8_t code, int32_t value)
+{
+  if (!ready)
+    return;
+  TraceEvent &e = box.events[box.head];
+  e.ms = millis();
+  e.type = type;
+  e.code = code;
+  e.value = value;
+  box.head = (box.head + 1) % TRACE_EVENTS;
+  if (box.count < TRACE_EVENTS)
+    ++box.count;
+}
+
+// Called by the profiler as each loop section starts (-1 between passes)
+void traceWhere(int section, bool nested)
+{
+  if (nested)
+    box.nested = section;
+  else
+    box.where = section;
+}
+
+/*
+ * Fault capture.  The naked handlers only find the stacked frame (on
+ * whichever stack was in use) and pass it on; nothing here may depend on
+ * the state of the rest of the program.
+ */
+extern "C" void blackBoxFault(uint32_t *frame, uint32_t kind)
+{
+  box.fault.kind = kind;
+  box.fault.where = box.where;
+  box.fault.nested = box.nested;
+  box.fault.r0 = frame[0];
+  box.fault.r1 = frame[1];
+  box.fault.r2 = frame[2];
+  box.fault.r3 = frame[3];
+  box.fault.r12 = frame[4];
+  box.fault.lr = frame[5];
+  box.fault.pc = frame[6];
+  box.fault.psr = frame[7];
+  box.fault.sp = (uint32_t)frame;
+  box.fault.cfsr = SCB_CFSR;
+  box.fault.hfsr = SCB_HFSR;
+  box.fault.mmfar = SCB_MMFAR;
+  box.fault.bfar = SCB_BFAR;
+  box.fault.ms = millis();
+  box.fault.magic = FAULT_MAGIC;
+  if (kind == FAULT_WATCHDOG)
+    while (true) ; // the watchdog reset is a few microseconds away
+  SCB_AIRCR = 0x05FA0004; // SYSRESETREQ
+  while (true) ;
+}
+
+#define CAPTURE_FRAME(kind) \
+  __asm__ volatile ( \
+    "tst lr, #4\n" \
+    "ite eq\n" \
+    "mrseq r0, msp\n" \
+    "mrsne r0, psp\n" \
+    "mov r1, #" #kind "\n" \
+    "b blackBoxFault\n")
+
+extern "C" void __attribute__((naked)) hard_fault_isr() { CAPTURE_FRAME(0); }
+extern "C" void __attribute__((naked)) memmanage_fault_isr() { CAPTURE_FRAME(0); }
+extern "C" void __attribute__((naked)) bus_fault_isr() { CAPTURE_FRAME(0); }
+extern "C" void __attribute__((naked)) usage_fault_isr() { CAPTURE_FRAME(0); }
+extern "C" void __attribute__((naked)) watchdog_isr() { CAPTURE_FRAME(1); }
+
+static const char *sectionName(uint8_t section)
+{
+  return section == NOWHERE ? "between passes" : section < PROFILE_COUNT ? profileSectionName(section) : "?";
+}
+
+static const char *resetCause()
+{
+  if (RCM_SRS0 & RCM_SRS0_POR)
+    return "power-on";
+  if (RCM_SRS0 & RCM_SRS0_LVD)
+    return "low voltage";
+  if (RCM_SRS0 & RCM_SRS0_WDOG)
+    return "watchdog";
+  if (RCM_SRS1 & RCM_SRS1_LOCKUP)
+    return "lockup";
+  if (RCM_SRS1 & RCM_SRS1_SW)
+    return "software";
+  if (RCM_SRS0 & (RCM_SRS0_LOC | RCM_SRS0_LOL))
+    return "clock loss";
+  if (RCM_SRS0 & RCM_SRS0_PIN)
+    return "reset pin";
+  return "unknown";
+}
+
+static void formatEvent(const TraceEvent &e, char *line, size_t size)
+{
+  const char *name = e.type < sizeof traceNames / sizeof *traceNames ? traceNames[e.type] : "?";
+  int n = snprintf(line, size, "%10lu %-12s ", (unsigned long)e.ms, name);
+  switch (e.type)
+  {
+    case TRACE_SLOW:
+      snprintf(line + n, size - n, "%s took %ld ms", sectionName(e.code), (long)e.value);
+      break;
+    case TRACE_IRIDIUM:
+      snprintf(line + n, size - n, "%s returned %ld", e.code < 3 ? iridiumOps[e.code] : "?", (long)e.value);
+      break;
+    case TRACE_COMMAND:
+    case TRACE_CONSOLE:
+      snprintf(line + n, size - n, "%c %ld", e.code, (long)e.value);
+      break;
+    case TRACE_FAULT:
+    case TRACE_RESTART:
+    case TRACE_RECOVERED:
+      snprintf(line + n, size - n, "%s %ld", supervisedName(e.code), (long)e.value);
+      break;
+    default:
+      snprintf(line + n, size - n, "%u %ld", e.code, (long)e.value);
+      break;
+  }
+}
+
+// Where the loop was, any fault, and the events, a line at a time
+static void report(void (*out)(const char *))
+{
+  char line[112];
+  snprintf(line, sizeof line, "Boot %lu, loop in %s", (unsigned long)box.boots, sectionName(box.where));
+  out(line);
+  if (box.nested != NOWHERE)
+  {
+    snprintf(line, sizeof line, "  (nested pass in %s)", sectionName(box.nested));
+    out(line);
+  }
+  if (box.fault.magic == FAULT_MAGIC)
+  {
+    snprintf(line, sizeof line, "%s at %lu ms in %s: pc %08lX lr %08lX psr %08lX sp %08lX",
+      faultNames[box.fault.kind & 1], (unsigned long)box.fault.ms, sectionName(box.fault.where),
+      (unsigned long)box.fault.pc, (unsigned long)box.fault.lr, (unsigned long)box.fault.psr, (unsigned long)box.fault.sp);
+    out(line);
+    snprintf(line, sizeof line, "  r0 %08lX r1 %08lX r2 %08lX r3 %08lX r12 %08lX",
+      (unsigned long)box.fault.r0, (unsigned long)box.fault.r1, (unsigned long)box.fault.r2,
+      (unsigned long)box.fault.r3, (unsigned long)box.fault.r12);
+    out(line);
+    snprintf(line, sizeof line, "  cfsr %08lX hfsr %08lX mmfar %08lX bfar %08lX",
+      (unsigned long)box.fault.cfsr, (unsigned long)box.fault.hfsr, (unsigned long)box.fault.mmfar, (unsigned long)box.fault.bfar);
+    out(line);
+  }
+  for (int i=0; i<box.count; ++i)
+  {
+    formatEvent(box.events[(box.head + TRACE_EVENTS - box.count + i) % TRACE_EVENTS], line, sizeof line);
+    out(line);
+  }
+}
+
+static File boxFile;
+static void toFile(const char *line)
+{
+  boxFile.print(line);
+  boxFile.print("\r\n");
+}
+
+static void toLog(const char *line)
+{
+  log("%s\r\n", line);
+}
+
+// Right after the SD card is opened: save what the last run left behind, then start afresh
+void startBlackBox()
+{
+  const char *cause = resetCause();
+  if (box.magic != BOX_MAGIC || box.head >= TRACE_EVENTS || box.count > TRACE_EVENTS)
+  {
+    // Power-up garbage (or a box the last reset didn't leave intact)
+    memset(&box, 0, sizeof box);
+    box.magic = BOX_MAGIC;
+    box.where = box.nested = NOWHERE;
+  }
+  else if (box.count > 0 || box.fault.magic == FAULT_MAGIC)
+  {
+    if (!SDFail() && boxFile.open("blackbox.log", O_CREAT | O_TRUNC | O_WRITE))
+    {
+      boxFile.print("Reset by ");
+      boxFile.print(cause);
+      boxFile.print("\r\n");
+      report(toFile);
+      boxFile.close();
+    }
+    log(F("Black box from the last run (%d events, see blackbox.log):\r\n"), box.count);
+    log(F("  reset by %s while in %s\r\n"), cause, sectionName(box.where));
+    if (box.fault.magic == FAULT_MAGIC)
+      log(F("  %s at pc %08lX in %s\r\n"), faultNames[box.fault.kind & 1], (unsigned long)box.fault.pc, sectionName(box.fault.where));
+  }
+
+  // Anything but a clean power-up is news for the ground
+  if (box.fault.magic == FAULT_MAGIC)
+    snprintf(resetSummary, sizeof resetSummary, "%s:%s:%lX", faultNames[box.fault.kind & 1],
+      sectionName(box.fault.where), (unsigned long)box.fault.pc);
+  else if (strcmp(cause, "power-on") != 0)
+    snprintf(resetSummary, sizeof resetSummary, "%s:%s", cause, sectionName(box.where));
+
+  box.fault.magic = 0;
+  box.head = box.count = 0;
+  box.where = box.nested = NOWHERE;
+  ++box.boots;
+  ready = true;
+  trace(TRACE_BOOT, 0, box.boots);
+}
+
+// Summary of an unexpected reset for the next primary message, or NULL
+const char *resetReport()
+{
+  return resetSummary[0] ? resetSummary : NULL;
+}
+
+void resetReported()
+{
+  resetSummary[0] = '\0';
+}
+
+void showBlackBox()
+{
+  report(toLog);
+}
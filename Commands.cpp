@@ -11,6 +11,16 @@ void showCommands()
   log(F("\r\n"));
   log(F("  WATCH [all|none|telemetry|iridium|runlog]\r\n"));
   log(F("  TYPE telemetry|iridium|runlog\r\n"));
+  log(F("  PROBES [scan]\r\n"));
+  log(F("  POWER\r\n"));
+  log(F("  PROFILE [reset|geodesy]\r\n"));
+  log(F("  STARTUP\r\n"));
+  log(F("  HEALTH\r\n"));
+  log(F("  BLACKBOX\r\n"));
+  log(F("  MEMORY\r\n"));
+  log(F("  RECORDER [now]\r\n"));
+  log(F("  LANDING\r\n"));
+  log(F("  BINARY\r\n"));
   log(F("\r\n"));
   log(F("Remote commands:\r\n"));
   log(F("\r\n"));
@@ -29,6 +39,9 @@ void showCommands()
   log(F("  I   request Info packet  0=Primary, 1=Secondary\r\n"));
   log(F("  C   change Cadence       Arg1: 0=Gnd, 1=Flt, 2=Lnd, 3=sec\r\n"));
   log(F("                           Arg2: interval (min)\r\n"));
+  log(F("  K   set altitude gain    Arg1: 0=Kp, 1=Kv, 2=Ki\r\n"));
+  log(F("                           Arg2: gain x 1000\r\n"));
+  log(F("  O   set Operating mode   0=Normal, 1=Alert, 2=Norway (opt, def=auto)\r\n"));
   log(F("\r\n"));
 }
 
@@ -54,6 +67,7 @@ void processScheduler()
     // Event in the past?
     if (events[i].timestamp != 0 && now >= events[i].timestamp)
     {
+      trace(TRACE_SCHEDULED, events[i].command, events[i].arg);
       switch(events[i].command)
       {
         case STARTBURST:
@@ -71,18 +85,22 @@ void processScheduler()
       }
 
       // Recurring pictures continue; everything else ceases
+      // (at a quarter of the rate when the power budget is tight)
       if (events[i].command == TAKEPICTURE && events[i].arg != ULONG_MAX)
-        events[i].timestamp += (int)events[i].arg;
+        events[i].timestamp += (int)events[i].arg * (powerThrottled(PowerInfo::FEWER_PICTURES) ? 4 : 1);
       else
         events[i].timestamp = 0;
     }
   }
   
-  if (target_altitude != LONG_MAX)
+  // The controller steps once per new snapshot
+  static uint32_t lastSequence = 0;
+  const Telemetry &t = getTelemetry();
+  if (target_altitude != LONG_MAX && t.sequence != lastSequence)
   {
-    const GPSInfo &gpsinf = getGPSInfo();
-    if (gpsinf.fixAcquired)
-      MaintainAltitude(target_altitude, gpsinf.altitude);
+    lastSequence = t.sequence;
+    if (t.gps.fixAcquired)
+      MaintainAltitude(target_altitude, t.gps.altitude);
   }
 }
 
@@ -148,6 +166,7 @@ bool executeConsoleCommand(char *cmd)
   char *tok1 = strsep(&p, " ");
   char *tok2 = strsep(&p, " ");
   char *errortok = NULL;
+  trace(TRACE_CONSOLE, toupper(*tok1));
 
   if (!stricmp(tok1, "watch"))
   {
@@ -174,6 +193,7 @@ bool executeConsoleCommand(char *cmd)
       if (getConsoleViewFlags() & LOG_RUNLOG)
         log("RUNLOG");
       log("\r\n");
+      showConsoleStats();
     }
   }
 
@@ -189,6 +209,73 @@ bool executeConsoleCommand(char *cmd)
       errortok = tok2;
   }
 
+  else if (!stricmp(tok1, "power"))
+  {
+    showPower();
+  }
+
+  else if (!stricmp(tok1, "binary"))
+  {
+    startGroundLink();
+  }
+
+  else if (!stricmp(tok1, "profile"))
+  {
+    if (tok2 && !stricmp(tok2, "reset"))
+      resetProfile();
+    else if (tok2 && !stricmp(tok2, "geodesy"))
+      benchmarkGeodesy();
+    else if (tok2 && strlen(tok2) > 0)
+      errortok = tok2;
+    else
+      showProfile();
+  }
+
+  else if (!stricmp(tok1, "health"))
+  {
+    showSupervisor();
+  }
+
+  else if (!stricmp(tok1, "memory"))
+  {
+    showMemory();
+  }
+
+  else if (!stricmp(tok1, "landing"))
+  {
+    showLanding();
+  }
+
+  else if (!stricmp(tok1, "recorder"))
+  {
+    if (tok2 && !stricmp(tok2, "now"))
+      recorderTrigger(TRIGGER_MANUAL);
+    else if (tok2 && strlen(tok2) > 0)
+      errortok = tok2;
+    else
+      showRecorder();
+  }
+
+  else if (!stricmp(tok1, "blackbox"))
+  {
+    showBlackBox();
+  }
+
+  else if (!stricmp(tok1, "startup"))
+  {
+    showStartup();
+  }
+
+  else if (!stricmp(tok1, "probes"))
+  {
+    if (tok2 && !stricmp(tok2, "scan"))
+      rescanThermalProbes();
+    else if (tok2 && strlen(tok2) > 0)
+      errortok = tok2;
+    else
+      showThermalProbes();
+  }
+
   else
   {
     errortok = tok1;
@@ -242,6 +329,7 @@ bool executeRemoteCommand(char *cmd)
     log("Arg2 = %lu\r\n", arg2);
     log("Time = %lu\r\n", getMissionTime());
     log("ExecTime = %ld\r\n", exectime);
+    trace(TRACE_COMMAND, command, arg1 == ULONG_MAX ? -1 : (int32_t)arg1);
     
     switch(command)
     {
@@ -251,6 +339,15 @@ bool executeRemoteCommand(char *cmd)
         break;
       case 'A':
         target_altitude = arg1 == ULONG_MAX ? LONG_MAX : (long)arg1;
+        if (target_altitude == LONG_MAX)
+          ReleaseAltitude();
+        break;
+      case 'K':
+        if (arg1 == ULONG_MAX || arg2 == ULONG_MAX || !setAltitudeGain((int)arg1, arg2 / 1000.0f))
+        {
+          log(F("Command error: K needs a gain (0-2) and a value\r\n"));
+          return false;
+        }
         break;
       case 'M':
         AddToScheduler(exectime, MACRO, arg1);
@@ -282,6 +379,13 @@ bool executeRemoteCommand(char *cmd)
       case 'C':
         Cadence(arg1, arg2);
         break;
+      case 'O':
+        if (!setPowerMode(arg1 == ULONG_MAX ? ModeProfile::AUTO : (int)arg1))
+        {
+          log(F("Command error: no operating mode %lu\r\n"), arg1);
+          return false;
+        }
+        break;
       default:
         log(F("Unknown command '%s'\r\n"), tok);
         return false;
@@ -3,6 +3,21 @@
 
 /*
  * Handle I/O to/from the Serial console
+ *
+ * Output goes into a ring buffer that a timer interrupt feeds to the UART
+ * as fast as the line takes it, so the loop never waits on the console.
+ * Each byte is tagged with the WATCH channel it came from.  If the ring
+ * fills (a slow terminal, or too much being watched) the oldest output is
+ * thrown away through to the next line break and counted against its
+ * channel.  Replies to console commands wait a little for room first,
+ * since somebody asked for them.
+ *
+ * So that one chatty channel can't keep the ring full and push everyone
+ * else's output out, each WATCH channel also has a token bucket of
+ * CHANNEL_RATE bytes a second, together less than the line carries.  A
+ * line that starts while its channel's bucket is empty is dropped whole
+ * (and counted); one that has started is let through, running the bucket
+ * into debt, so nothing is cut off mid-line.
  */
 
 static uint8_t consoleView = LOG_IRIDIUM | LOG_TELEMETRY | LOG_RUNLOG;
@@ -10,9 +25,134 @@ static uint8_t consoleView = LOG_IRIDIUM | LOG_TELEMETRY | LOG_RUNLOG;
 // The Serial console
 static ConsoleType &console = ConsoleSerial;
 
+// Transmit ring
+static const uint16_t TX_BUFFER = 4096;           // must be a power of two
+static const unsigned long REPLY_WAIT = 100UL;    // ms a reply may wait for room
+static char txData[TX_BUFFER];
+static uint8_t txChannel[TX_BUFFER];              // 0 for replies, else a LOGTYPE
+static volatile uint16_t txHead = 0, txTail = 0;  // next to send, next free
+static IntervalTimer txTimer;
+static unsigned long dropped[4];                  // bytes thrown away, by channel
+static const char *channelNames[] = {"replies", "iridium", "telemetry", "runlog"};
+
+// Per-channel rate limits (replies and ground link frames have none)
+static const long CHANNEL_RATE = 3;               // bytes per ms: 3 channels at 3000/s < 11520/s
+static const long CHANNEL_BURST = 2048;           // a whole telemetry record, with room to spare
+static struct
+{
+  long tokens;
+  unsigned long refilled;                         // millis() of the last top-up
+  bool inLine, dropping;
+} buckets[4];
+
+// Run log characters written one at a time (log(char)) while the ground
+// link is up, gathered into a line for a TEXT frame
+static char linkLine[81];
+static int linkLineLength = 0;
+
+static int channelIndex(uint8_t channel)
+{
+  return channel == LOG_RUNLOG ? 3 : channel; // LOG_IRIDIUM is 1, LOG_TELEMETRY 2
+}
+
+// Timer interrupt: top up the UART from the ring
+static void drainConsole()
+{
+  while (txHead != txTail && console.availableForWrite() > 0)
+  {
+    console.write(txData[txHead]);
+    txHead = (txHead + 1) & (TX_BUFFER - 1);
+  }
+}
+
+// Make room by discarding the oldest output, through to a line break (or frame delimiter)
+static void dropOldest()
+{
+  __disable_irq();
+  uint16_t head = txHead;
+  char c;
+  do
+  {
+    c = txData[head];
+    dropped[channelIndex(txChannel[head])]++;
+    head = (head + 1) & (TX_BUFFER - 1);
+  } while (c != (groundLinkActive() ? '\0' : '\n') && head != txTail); // a whole line, or a whole frame
+  txHead = head;
+  __enable_irq();
+}
+
+// Should this byte go in, as far as its channel's rate goes?
+static bool admit(char c, uint8_t channel)
+{
+  if (channel == 0)
+    return true;
+  int i = channelIndex(channel);
+  unsigned long now = millis();
+  unsigned long ms = min(now - buckets[i].refilled, (unsigned long)CHANNEL_BURST);
+  buckets[i].tokens = min(buckets[i].tokens + (long)ms * CHANNEL_RATE, CHANNEL_BURST);
+  buckets[i].refilled = now;
+
+  if (!buckets[i].inLine)
+    buckets[i].dropping = buckets[i].tokens <= 0; // decided once a line
+  buckets[i].inLine = c != '\n';
+  if (buckets[i].dropping)
+  {
+    dropped[i]++;
+    return false;
+  }
+  --buckets[i].tokens;
+  return true;
+}
+
+static void enqueue(char c, uint8_t channel)
+{
+  if (!admit(c, channel))
+    return;
+  uint16_t next = (txTail + 1) & (TX_BUFFER - 1);
+  if (next == txHead && channel == 0)
+  {
+    unsigned long start = millis();
+    while (next == txHead && millis() - start < REPLY_WAIT)
+      ;
+  }
+  if (next == txHead)
+    dropOldest();
+  txData[txTail] = c;
+  txChannel[txTail] = channel;
+  txTail = next;
+}
+
 void startConsole()
 {
   console.begin(consoleBaud);
+  txTimer.begin(drainConsole, 1000); // every ms; the UART's own buffer covers the gap
+}
+
+// Bytes that can be queued right now without dropping anything
+int consoleRoom()
+{
+  return (txHead - txTail - 1) & (TX_BUFFER - 1);
+}
+
+// Queue raw bytes (ground link frames), bypassing the WATCH channels
+void consoleWrite(const uint8_t *data, int length)
+{
+  while (length-- > 0)
+    enqueue(*data++, 0);
+}
+
+// True while there is output the UART hasn't taken yet
+bool consoleBusy()
+{
+  return txHead != txTail;
+}
+
+void showConsoleStats()
+{
+  log("Console output dropped:");
+  for (int i=0; i<4; ++i)
+    log(" %s=%lu", channelNames[i], dropped[i]);
+  log("\r\n");
 }
 
 void processConsole()
@@ -23,6 +163,12 @@ void processConsole()
   while (console.available())
   {
     char c = console.read();
+    wakeDisplay("console");
+    if (groundLinkActive())
+    {
+      groundLinkByte(c);
+      continue;
+    }
     if (c == '\r' || c == '\n' || index == sizeof buf - 1)
     {
       buf[index] = 0; // null terminator
@@ -37,6 +183,7 @@ void processConsole()
       buf[index++] = c;
     }
   }
+  processGroundLink();
 }
 
 uint8_t getConsoleViewFlags()
@@ -49,23 +196,51 @@ void setConsoleViewFlags(uint8_t flags)
   consoleView = flags;
 }
 
-void consoleText(const char *str)
+static void sendLinkLine()
 {
-  console.print(str);
+  if (linkLineLength == 0)
+    return;
+  linkLine[linkLineLength] = 0;
+  linkLineLength = 0;
+  groundLinkText(linkLine);
 }
 
-void consoleText(int n)
+void consoleText(const char *str, uint8_t channel)
 {
-  console.print(n);
+  // With the ground link up only the run log gets through, and that in frames
+  if (groundLinkActive())
+  {
+    if (channel == LOG_RUNLOG)
+    {
+      sendLinkLine(); // anything written a character at a time goes first
+      groundLinkText(str);
+    }
+    return;
+  }
+  while (*str)
+    enqueue(*str++, channel);
 }
 
-void consoleText(char c)
+void consoleText(int n, uint8_t channel)
 {
-  console.write(c);
+  char digits[12];
+  TextWriter(digits).number(n);
+  consoleText(digits, channel);
 }
 
-void consoleText(FlashString fs)
+void consoleText(char c, uint8_t channel)
 {
-  console.print(fs);
+  if (!groundLinkActive())
+    enqueue(c, channel);
+  else if (channel == LOG_RUNLOG)
+  {
+    linkLine[linkLineLength++] = c;
+    if (c == '\n' || linkLineLength == (int)sizeof linkLine - 1)
+      sendLinkLine();
+  }
 }
-
+
+void consoleText(FlashString fs, uint8_t channel)
+{
+  consoleText(reinterpret_cast<const char *>(fs), channel); // flash is directly addressable on ARM
+}
@@ -1,4 +1,5 @@
 #include <Arduino.h>
+#include <Wire.h>       // I2C bus management for OLED Display
 #include <Adafruit_GFX.h> // Adafruit base graphics library
 #include <Adafruit_SSD1306.h> // Adafruit SSD1306 library
 #include "BalloonRide.h"
@@ -16,13 +17,11 @@ static bool started = false;
 #if ADAFRUIT128x96
 #define I2C_ADDR 0x3D
 #define ROWS 96
-#define BIGTEXTSIZE 3
 #endif
 
 #if TWOCOLOR128x64
 #define I2C_ADDR 0x3C
 #define ROWS 64
-#define BIGTEXTSIZE 1
 #endif
 
 //------------------------------------------------------------------------------
@@ -97,8 +96,46 @@ static const unsigned char SundialLogo[] = {
 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
 
+/*
+ * The splash (logo, then title) no longer holds up setup().  The startup
+ * messages from the other subsystems go up under the title, and the status
+ * screen takes over once everything has started and the title has been up
+ * long enough to read.
+ */
+static const unsigned long LOGO_MS = 3000;
+static const unsigned long TITLE_MS = 2000; // allow display message to sink in
+static unsigned long splashStart = 0;
+static bool logoShowing = false;
+
+static void showTitle()
+{
+  logoShowing = false;
+  splashStart = millis();
+  display.invertDisplay(false);
+  display.clearDisplay();
+  display.setTextSize(1);
+  display.setTextColor(WHITE);
+  display.setCursor(0, 0);
+  display.println(PROGRAMNAME " " VERSION);
+  display.println(SMALLCOPYRIGHT);
+  display.display();
+}
+
+// Still showing the logo or the title and startup messages?
+static bool splashShowing()
+{
+  if (logoShowing)
+  {
+    if (millis() - splashStart >= LOGO_MS)
+      showTitle();
+    return true;
+  }
+  return millis() - splashStart < TITLE_MS || !startupComplete();
+}
+
 void startDisplay()
 {
+  startupBegin(STARTUP_DISPLAY);
   consoleText(F("Starting display..."));
   started = true;
 
@@ -108,185 +145,365 @@ void startDisplay()
   display.drawBitmap(0, 0, SundialLogo, 128, ROWS, WHITE);
   display.invertDisplay(true);
   display.display();
-  delay(3000);
+  logoShowing = true;
+  splashStart = millis();
+#else
+  showTitle();
 #endif
-  
-  // Clear the buffer.
-  display.invertDisplay(false);
-  display.clearDisplay();
-  display.setTextSize(1);
-  display.setTextColor(WHITE);
-  display.display();
-  display.setCursor(0, 0);
-  display.println(PROGRAMNAME " " VERSION);
-  display.println(SMALLCOPYRIGHT);
-  display.display();
-  delay(2000); // allow display message to sink in
-  display.clearDisplay();
-  display.setCursor(0, 0);
-  display.display();
   consoleText(F("done.\r\n"));
+  startupDone(STARTUP_DISPLAY);
 }
 
-void processDisplay()
+/*
+ * Incremental rendering.  The status screen is a grid of 6x8 text cells, so
+ * each text row maps onto exactly one SSD1306 page.  We remember what is on
+ * the glass, redraw only the cells that changed, and queue only the changed
+ * columns of the affected pages for transfer.
+ *
+ * The transfer itself runs in the background: serviceDisplay() moves at most
+ * one small I2C transaction per call and is called from the main loop and
+ * from the GPS read loop, so rendering never waits on the display bus.  A
+ * span that changes again before it has gone out is simply merged, and the
+ * newest pixels are what get sent.
+ */
+#define TEXTCOLS (SSD1306_LCDWIDTH / 6)
+#define TEXTLINES (ROWS / 8)
+#define STATUSLINES 4
+#define I2C_CHUNK 16 // data bytes per I2C transaction (Wire buffer is 32)
+
+static char shown[TEXTLINES][TEXTCOLS + 1]; // text currently on the glass
+static bool fullRefresh = true;             // glass contents unknown: redraw everything
+
+// Columns of each page waiting to be sent (dirtyFirst > dirtyLast means clean)
+static uint8_t dirtyFirst[TEXTLINES], dirtyLast[TEXTLINES];
+static bool dirtyInitialized = false;
+
+// The transfer in progress, if any
+static int activePage = -1;
+static uint8_t activeCol, activeLast;
+
+static void markDirty(int page, uint8_t col0, uint8_t col1)
 {
-  static time_t lastDisplayTime = 0;
+  if (!dirtyInitialized)
+  {
+    memset(dirtyFirst, 0xFF, sizeof dirtyFirst);
+    memset(dirtyLast, 0, sizeof dirtyLast);
+    dirtyInitialized = true;
+  }
+  if (col0 < dirtyFirst[page])
+    dirtyFirst[page] = col0;
+  if (col1 > dirtyLast[page])
+    dirtyLast[page] = col1;
+}
 
-  // Display max once per second
-  if (getMissionTime() > lastDisplayTime)
+bool displayBusy()
+{
+  if (activePage != -1)
+    return true;
+  if (dirtyInitialized)
+    for (int page=0; page<TEXTLINES; ++page)
+      if (dirtyFirst[page] <= dirtyLast[page])
+        return true;
+  return false;
+}
+
+// Move the next small piece of pending frame buffer data to the panel
+void serviceDisplay()
+{
+  if (!started || !dirtyInitialized)
+    return;
+
+  // Nothing in flight: claim the next dirty span and address it
+  if (activePage == -1)
   {
-    lastDisplayTime = getMissionTime();
-    bool flash = lastDisplayTime % 2 == 1;
-    display.clearDisplay();
-
-    // Mission time
-    unsigned hour = (unsigned)(lastDisplayTime / 3600);
-    unsigned minute = (unsigned)((lastDisplayTime - 3600UL * hour) / 60);
-    unsigned second = (unsigned)(lastDisplayTime % 60);
-    display.setCursor(0, 0);
-    display.print(hour < 10 ? "0" : "");
-    display.print(hour);
-    display.print(minute < 10 ? ":0" : ":");
-    display.print(minute);
-    display.print(second < 10 ? ":0" : ":");
-    display.print(second);
-    display.print(" ");
-
-    // "Transmitting"
-    // Upper right region
-    display.print(flash && getIridiumInfo().isTransmitting ? "TR " : "   ");
-    display.print(rockBLOCKRingPin == -1 ? "-- " : !getIridiumInfo().isTransmitting ? "SL " : digitalRead(rockBLOCKRingPin) == HIGH ? "NR " : "RI ");
-    
-    // Display certain error conditions
-    if (Code3())
-      display.println(flash ? "CODE3" : "");
-    else if (SDFail())
-      display.println(flash ? "SDFAIL" : "");
-    else
-      display.println();
+    for (int page=0; page<TEXTLINES; ++page)
+      if (dirtyFirst[page] <= dirtyLast[page])
+      {
+        activePage = page;
+        activeCol = dirtyFirst[page];
+        activeLast = dirtyLast[page];
+        dirtyFirst[page] = 0xFF;
+        dirtyLast[page] = 0;
+        break;
+      }
+    if (activePage == -1)
+      return;
 
-    // Time since fix
-    display.print("Fix: ");
-    long age = getGPSInfo().age / 1000;
-    if (!getGPSInfo().fixAcquired)
+    display.ssd1306_command(SSD1306_COLUMNADDR);
+    display.ssd1306_command(activeCol);
+    display.ssd1306_command(activeLast);
+    display.ssd1306_command(SSD1306_PAGEADDR);
+    display.ssd1306_command(activePage);
+    display.ssd1306_command(activePage);
+    return;
+  }
+
+  // Otherwise send one chunk of the active span
+  int n = activeLast - activeCol + 1;
+  if (n > I2C_CHUNK)
+    n = I2C_CHUNK;
+  Wire.beginTransmission(I2C_ADDR);
+  Wire.write(0x40); // Co = 0, D/C = 1: data follows
+  Wire.write(display.getBuffer() + activePage * SSD1306_LCDWIDTH + activeCol, n);
+  Wire.endTransmission();
+  if (activeCol + n > activeLast)
+    activePage = -1;
+  else
+    activeCol += n;
+}
+
+// Drain everything pending (used only where we cannot return to the loop)
+static void flushDisplay()
+{
+  while (displayBusy())
+    serviceDisplay();
+}
+
+// Draw one line of status text, touching only the cells that differ from what is shown
+static void renderLine(int row, const char *text)
+{
+  char padded[TEXTCOLS + 1];
+  snprintf(padded, sizeof padded, "%-*s", TEXTCOLS, text);
+
+  int first = -1, last = -1;
+  for (int col=0; col<TEXTCOLS; ++col)
+    if (padded[col] != shown[row][col])
     {
-      display.print("None. ");
+      if (first == -1)
+        first = col;
+      last = col;
     }
+
+  if (first == -1)
+    return;
+
+  display.fillRect(first * 6, row * 8, (last - first + 1) * 6, 8, BLACK);
+  for (int col=first; col<=last; ++col)
+    display.drawChar(col * 6, row * 8, padded[col], WHITE, BLACK, 1);
+  memcpy(shown[row], padded, sizeof padded);
+  markDirty(row, first * 6, last * 6 + 5);
+}
+
+// The worst condition worth flashing on the status line, or NULL
+static const char *alarmText()
+{
+  if (Code3())
+    return "CODE3";
+  if (SDFail())
+    return "SDFAIL";
+  if (getHealth(SUPERVISE_GPS) == HEALTH_DOWN)
+    return "NO GPS";
+  if (getHealth(SUPERVISE_IRIDIUM) == HEALTH_DOWN)
+    return "NO SAT";
+  return NULL;
+}
+
+/*
+ * Power management.  Nobody can read the panel once the balloon is aloft, so
+ * it goes dark (display off and charge pump off) when the balloon takes off or
+ * when nothing interesting has happened for a while.  Console activity, a
+ * landing, or a new error condition brings it back.
+ */
+static const time_t DISPLAY_IDLE_TIMEOUT = 30 * 60; // seconds after the last wake event
+static bool panelOn = true;
+static time_t lastWakeTime = 0;
+static time_t takeoffTime = 0;
+static time_t panelOffSince = 0;
+static unsigned long panelOffSeconds = 0; // total time spent dark
+
+static void panelPower(bool on, const char *reason)
+{
+  if (on == panelOn)
+    return;
+  panelOn = on;
+
+  time_t now = getMissionTime();
+  if (on)
+  {
+    panelOffSeconds += now - panelOffSince;
+    display.ssd1306_command(SSD1306_CHARGEPUMP);
+    display.ssd1306_command(0x14); // enable
+    display.ssd1306_command(SSD1306_DISPLAYON);
+    log(F("Display on (%s); dark %lu s so far, ~%.2f mAh saved\r\n"),
+      reason, panelOffSeconds, DISPLAY_ON_MA * panelOffSeconds / 3600.0f);
+  }
+  else
+  {
+    panelOffSince = now;
+    display.ssd1306_command(SSD1306_DISPLAYOFF);
+    display.ssd1306_command(SSD1306_CHARGEPUMP);
+    display.ssd1306_command(0x10); // disable
+    log(F("Display off (%s)\r\n"), reason);
+  }
+}
+
+bool displayIsOn()
+{
+  return started && panelOn;
+}
+
+void wakeDisplay(const char *reason)
+{
+  lastWakeTime = getMissionTime();
+  if (started)
+    panelPower(true, reason);
+}
+
+// Called once per second: look for wake events and decide whether the panel should be lit
+static void manageDisplayPower()
+{
+  static int lastFlightState = BalloonInfo::ONGROUND;
+  static bool lastError = false;
+  time_t now = getMissionTime();
+  int flightState = getTelemetry().balloon.flightState;
+  const char *alarm = alarmText();
+  bool error = alarm != NULL;
+
+  if (flightState == BalloonInfo::INFLIGHT && lastFlightState != BalloonInfo::INFLIGHT)
+    takeoffTime = now;
+  if (flightState == BalloonInfo::LANDED && lastFlightState != BalloonInfo::LANDED)
+    wakeDisplay("landing");
+  if (error && !lastError)
+    wakeDisplay(alarm);
+  lastFlightState = flightState;
+  lastError = error;
+
+  if (powerThrottled(PowerInfo::NO_DISPLAY))
+    panelPower(false, "power budget");
+  else if (!getModeProfile().displayAllowed)
+    panelPower(false, getModeProfile().name);
+  else if (flightState == BalloonInfo::INFLIGHT && lastWakeTime <= takeoffTime)
+    panelPower(false, "in flight");
+  else if (now - lastWakeTime >= DISPLAY_IDLE_TIMEOUT)
+    panelPower(false, "idle");
+}
+
+void processDisplay()
+{
+  static uint32_t lastSequence = 0;
+
+  if (splashShowing())
+    return;
+
+  // Redraw for each new telemetry snapshot (once per second)
+  const Telemetry &t = getTelemetry();
+  if (t.sequence != lastSequence)
+  {
+    lastSequence = t.sequence;
+    time_t now = t.time;
+    manageDisplayPower();
+    if (!panelOn)
+      return;
+
+    bool flash = now % 2 == 1;
+    const GPSInfo &ginf = t.gps;
+    const ThermalInfo &tinf = t.thermal;
+    char text[TEXTLINES][TEXTCOLS + 1];
+    char field[TEXTCOLS + 1];
+
+    // Mission time, "Transmitting" and ring state, and certain error conditions
+    unsigned hour = (unsigned)(now / 3600);
+    unsigned minute = (unsigned)((now - 3600UL * hour) / 60);
+    unsigned second = (unsigned)(now % 60);
+    snprintf(text[0], sizeof text[0], "%02u:%02u:%02u %s%s%s", hour, minute, second,
+      flash && t.iridium.isTransmitting ? "TR " : "   ",
+      rockBLOCKRingPin == -1 ? "-- " : !t.iridium.isTransmitting ? "SL " : digitalRead(rockBLOCKRingPin) == HIGH ? "NR " : "RI ",
+      flash && alarmText() ? alarmText() : "");
+
+    // Time since fix
+    long age = ginf.age / 1000;
+    if (!ginf.fixAcquired)
+      strcpy(field, "None. ");
     else if (age > 15 && flash) // flash if no GPS in >15 seconds
-    {
-      display.print("      ");
-    }
+      strcpy(field, "      ");
     else if (age < 10)
-    {
-      display.print("Ok.   ");
-    }
+      strcpy(field, "Ok.   ");
     else
-    {
-      display.print(age);
-      if (age < 1000) display.print(" ");
-      if (age < 100) display.print(" ");
-      if (age < 10) display.print(" ");
-      display.print(" ");
-    }
+      snprintf(field, sizeof field, "%-4ld ", age);
+    int len = snprintf(text[1], sizeof text[1], "Fix: %sX: ", field);
 
     // Time since last successful transmission
-    display.print("X: ");
-    age = getMissionTime() - getIridiumInfo().xmitTime1;
-    
-    if (getIridiumInfo().xmitTime1 == 0)
-    {
-      display.println("None.");
-    }
+    age = now - t.iridium.xmitTime1;
+    if (t.iridium.xmitTime1 == 0)
+      strcpy(field, "None.");
     else if (age > 15 * 60 && flash) // flash if no Xmit in >15 minutes
-    {
-      display.println("     ");    
-    }
+      strcpy(field, "     ");
     else
     {
       minute = (unsigned)(age / 60);
       second = (unsigned)(age % 60);
-      display.print(minute < 10 ? "0" : "");
-      display.print(minute > 999 ? 999 : minute);
-      display.print(":");
-      display.print(second < 10 ? "0" : "");
-      display.print(second);
-      display.println();
+      snprintf(field, sizeof field, "%02u:%02u", minute > 999 ? 999 : minute, second);
     }
+    snprintf(text[1] + len, sizeof text[1] - len, "%s", field);
 
-#if ADAFRUIT128x96
-    display.println();
-    display.setTextSize(BIGTEXTSIZE);
-    switch((now / 5) % 2)
-    {
-      case 0:
-        if (getGPSInfo().altitude < 10000)
-          display.print(" ");
-        if (getGPSInfo().altitude == 0) 
-        {
-          display.print("---");
-        }
-        else 
-        {
-          display.print(getGPSInfo().altitude);
-          display.print("m");
-        }
-        break;
-      case 1:
-        if (getThermalInfo().temperature[1] >= 0)
-          display.print(" ");
-        display.print(getThermalInfo().temperature[1], 1);
-        display.print("C");
-        break;
-    }
-#else
-    display.print(F("ALT: "));
-    if (getGPSInfo().altitude < 10000)
-      display.print(" ");
-    if (getGPSInfo().altitude == 0) 
-    {
-      display.print("--- ");
-    }
-    else 
-    {
-      display.print(getGPSInfo().altitude);
-      display.print("m ");
-    }
-    display.print("ET:");
-    if (getThermalInfo().temperature[1] >= 0)
-      display.print(" ");
-    if (getThermalInfo().temperature[1] == INVALID_TEMPERATURE)
-      display.print(" --- ");
+    // Altitude and external temperature
+    if (ginf.altitude == 0)
+      strcpy(field, "--- ");
     else
+      snprintf(field, sizeof field, "%ldm ", ginf.altitude);
+    len = snprintf(text[2], sizeof text[2], "ALT: %s%sET:", ginf.altitude < 10000 ? " " : "", field);
+    if (tinf.temperature[1] == INVALID_TEMPERATURE)
+      strcpy(field, " --- ");
+    else
+      snprintf(field, sizeof field, "%s%.1fC", tinf.temperature[1] >= 0 ? " " : "", tinf.temperature[1]);
+    snprintf(text[2] + len, sizeof text[2] - len, "%s", field);
+
+    // Voltage and message count
+    snprintf(text[3], sizeof text[3], "%.2fV XC:%lu IT:%.1fC",
+      t.battery.batteryVoltage, t.iridium.count, tinf.temperature[0]);
+
+    // Any additional thermal probes, two to a line
+    for (int row=STATUSLINES; row<TEXTLINES; ++row)
     {
-      display.print(getThermalInfo().temperature[1], 1);
-      display.print("C");
+      int first = 2 + 2 * (row - STATUSLINES);
+      len = 0;
+      text[row][0] = '\0';
+      for (int i=first; i<first + 2 && i<tinf.probeCount; ++i)
+      {
+        if (tinf.temperature[i] == INVALID_TEMPERATURE)
+          strcpy(field, " --- ");
+        else
+          snprintf(field, sizeof field, "%.1fC", tinf.temperature[i]);
+        len += snprintf(text[row] + len, sizeof text[row] - len, "T%d:%-7s", i, field);
+      }
     }
-#endif
 
-    // Voltage and message count
-#if ADAFRUIT128x96
-    display.setTextSize(1);
-    display.setCursor(0, 64 - 7);
-#else
-    display.println();
-#endif
+    // Something else (startup text, an error message) has drawn on the glass: start over
+    if (fullRefresh)
+    {
+      display.clearDisplay();
+      for (int row=0; row<TEXTLINES; ++row)
+      {
+        snprintf(shown[row], sizeof shown[row], "%-*s", TEXTCOLS, "");
+        markDirty(row, 0, SSD1306_LCDWIDTH - 1);
+      }
+      fullRefresh = false;
+    }
 
-    display.print(getBatteryInfo().batteryVoltage, 2);
-    display.print("V XC:");
-    display.print(getIridiumInfo().count);
-    display.print(" IT:");
-    display.print(getThermalInfo().temperature[0], 1);
-    display.print("C");
-    display.display();
+    for (int row=0; row<TEXTLINES; ++row)
+      renderLine(row, text[row]);
   }
 }
 
+// Startup and fatal messages: send just the pages the text landed on, right away
+template<typename T> static void printText(T t)
+{
+  if (logoShowing)
+    return;
+  int row0 = display.getCursorY() / 8;
+  display.print(t);
+  int row1 = display.getCursorY() / 8;
+  for (int row=row0; row<=row1 && row<TEXTLINES; ++row)
+    markDirty(row, 0, SSD1306_LCDWIDTH - 1);
+  flushDisplay();
+  fullRefresh = true;
+}
+
 void displayText(const char *str)
 {
   if (started)
   {
-    display.print(str);
-    display.display();
+    printText(str);
   }
 }
 
@@ -294,8 +511,7 @@ void displayText(int n)
 {
   if (started)
   {
-    display.print(n);
-    display.display();
+    printText(n);
   }
 }
 
@@ -303,8 +519,7 @@ void displayText(FlashString fs)
 {
   if (started)
   {
-    display.print(fs);
-    display.display();
+    printText(fs);
   }
 }
 
@@ -0,0 +1,187 @@
+#include <Arduino.h>
+#include "BalloonRide.h"
+
+/*
+ * Number formatting for the telemetry log and the Iridium packets
+ *
+ * newlib's printf pulls in its whole floating point engine and, working in
+ * double, runs entirely in soft-float on the M4.  TextWriter produces the
+ * same characters as the conversions it replaces ("%.2f" of a float,
+ * "%.6f" of a position in 1e-7 degrees, "%03d" and friends) with integer
+ * arithmetic, writing straight into the caller's buffer.
+ *
+ * printf rounds the exact binary value it's handed, to even on a tie, and
+ * so do we: a float is taken apart into mantissa and exponent and scaled
+ * exactly.  A fixed-point value is printed as printf would print the double
+ * nearest to it, which only matters when it lies exactly halfway between
+ * two printable values.
+ */
+
+static const uint32_t powersOf10[] =
+  {1UL, 10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL, 10000000UL, 100000000UL, 1000000000UL};
+static const int MAX_DECIMALS = 9;
+
+// num/den lies exactly halfway between two printable values.  Does the
+// double nearest to it lie above (round up), below (round down) or exactly
+// on it (round to even)?
+static bool tieRoundsUp(uint32_t num, uint32_t den, bool odd)
+{
+  uint32_t q = num / den, r = num % den;
+  int bits = 0; // significant bits of the quotient so far
+  for (uint32_t i = q; i; i >>= 1)
+    ++bits;
+  bool last = q & 1;
+
+  // Long division in binary out to the 53 bits a double holds
+  while (bits < 53 && r != 0)
+  {
+    r <<= 1;
+    last = r >= den;
+    if (last)
+      r -= den;
+    if (bits > 0 || last)
+      ++bits;
+  }
+  if (r == 0)
+    return odd;
+  return 2 * r > den || (2 * r == den && last);
+}
+
+TextWriter &TextWriter::text(char c)
+{
+  if (len + 1 < size)
+  {
+    buf[len++] = c;
+    buf[len] = '\0';
+  }
+  return *this;
+}
+
+TextWriter &TextWriter::text(const char *s)
+{
+  while (*s)
+    text(*s++);
+  return *this;
+}
+
+// Like printf's "%*lu" (pad ' ') or "%0*lu" (pad '0'), with an optional sign
+TextWriter &TextWriter::digits(unsigned long magnitude, bool negative, int width, char pad)
+{
+  char reversed[10];
+  int n = 0;
+  do
+  {
+    reversed[n++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude);
+
+  int fill = width - n - (negative ? 1 : 0);
+  if (pad != '0')
+    for (; fill > 0; --fill)
+      text(pad);
+  if (negative)
+    text('-');
+  for (; fill > 0; --fill)
+    text('0');
+  while (n > 0)
+    text(reversed[--n]);
+  return *this;
+}
+
+TextWriter &TextWriter::fixedDigits(uint32_t whole, uint32_t fraction, bool negative, int decimals)
+{
+  digits(whole, negative, 0, ' ');
+  if (decimals > 0)
+  {
+    text('.');
+    digits(fraction, false, decimals, '0');
+  }
+  return *this;
+}
+
+// Like printf("%.*f", decimals, value)
+TextWriter &TextWriter::fixed(float value, int decimals)
+{
+  decimals = constrain(decimals, 0, MAX_DECIMALS);
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof bits);
+  bool negative = bits >> 31;
+  int exponent = (bits >> 23) & 0xFF;
+  uint32_t mantissa = bits & 0x7FFFFF;
+
+  if (exponent == 0xFF)
+    return text(mantissa ? "nan" : negative ? "-inf" : "inf");
+  if (exponent == 0)
+    exponent = 1; // denormal
+  else
+    mantissa |= 0x800000;
+
+  // value is mantissa * 2^-shift; nothing we log is anywhere near 2^24
+  int shift = 150 - exponent;
+  if (shift < 0)
+  {
+    char big[64];
+    snprintf(big, sizeof big, "%.*f", decimals, value);
+    return text(big);
+  }
+
+  // Scale exactly by 10^decimals, then shift down rounding half to even
+  uint64_t scaled = (uint64_t)mantissa * powersOf10[decimals];
+  uint64_t q = shift < 64 ? scaled >> shift : 0;
+  if (shift > 0 && shift < 64)
+  {
+    uint64_t rest = scaled & ((1ULL << shift) - 1), half = 1ULL << (shift - 1);
+    if (rest > half || (rest == half && (q & 1)))
+      ++q;
+  }
+
+  if (q >> 32)
+    return fixedDigits(q / powersOf10[decimals], q % powersOf10[decimals], negative, decimals);
+  uint32_t q32 = q;
+  return fixedDigits(q32 / powersOf10[decimals], q32 % powersOf10[decimals], negative, decimals);
+}
+
+// value / 10^places, like printf("%.*f", decimals, value / 1e<places>)
+TextWriter &TextWriter::fixed(long value, int places, int decimals)
+{
+  places = constrain(places, 0, MAX_DECIMALS);
+  decimals = constrain(decimals, 0, places);
+  bool negative = value < 0;
+  uint32_t magnitude = negative ? 0UL - (uint32_t)value : (uint32_t)value;
+
+  int drop = places - decimals;
+  uint32_t q = magnitude / powersOf10[drop], rest = magnitude % powersOf10[drop];
+  if (drop > 0)
+  {
+    uint32_t half = powersOf10[drop] / 2;
+    if (rest > half || (rest == half && tieRoundsUp(magnitude, powersOf10[places], q & 1)))
+      ++q;
+  }
+  return fixedDigits(q / powersOf10[decimals], q % powersOf10[decimals], negative, decimals);
+}
+
+// A latitude or longitude in 1e-7 degrees.  The no-fix sentinel prints as
+// -1000, as it did when positions were doubles, so the ground tools still
+// recognize it.
+TextWriter &TextWriter::coordinate(long e7, int decimals)
+{
+  if (e7 == INVALID_LATLONG)
+    return fixed(-1000.0f, decimals);
+  return fixed(e7, 7, decimals);
+}
+
+// YYYY-MM-DD hh:mm:ss
+TextWriter &TextWriter::timestamp(int year, int month, int day, int hour, int minute, int second)
+{
+  return number(year, 4, '0').text('-').number(month, 2, '0').text('-').number(day, 2, '0').text(' ')
+    .number(hour, 2, '0').text(':').number(minute, 2, '0').text(':').number(second, 2, '0');
+}
+
+// "mean,min,max,sd", or just the commas if there was nothing to summarize
+TextWriter &TextWriter::statistic(const Statistic &s, int decimals)
+{
+  if (s.count == 0)
+    return text(",,,");
+  return fixed(s.mean, decimals).text(',').fixed(s.min, decimals).text(',').fixed(s.max, decimals)
+    .text(',').fixed(sqrtf(s.variance()), decimals);
+}
@@ -8,58 +8,138 @@
 static HardwareSerial &gps = GPSSerial;
 static TinyGPSPlus tinyGps;
 static struct GPSInfo info;
+static bool powered = false;
+static bool fastFixes = false;                     // 2 Hz for the flight recorder, else the module's 1 Hz
+static const time_t GPS_DUTY_OFF_SECONDS = 4 * 60; // off time between fixes when duty cycling
+static const float TRACK_MIN_STEP = 20.0f;          // meters; smaller moves are mostly GPS jitter
+static Odometer track;
+static const float CLIMB_SMOOTHING = 0.3;          // of each new fix-to-fix vertical speed
+static const unsigned long SILENT_MS = 5000;       // powered but silent this long: wiring or module fault
+static const uint32_t DETECT_CHARS = 100;
+static unsigned long lastHeard = 0;                // millis() of the latest characters, or of power-on
+static uint32_t charsAtPowerOn = 0;
+
+// TinyGPS++ keeps the degrees and billionths apart; fold them into 1e-7 degree units
+static long toE7(const RawDegrees &raw)
+{
+  long e7 = raw.deg * 10000000L + (raw.billionths + 50) / 100;
+  return raw.negative ? -e7 : e7;
+}
 
 void gpsOn()
 {
   pinMode(gpsPowerPin, INPUT);
+  powered = true;
+  lastHeard = millis();
+  charsAtPowerOn = tinyGps.charsProcessed();
 }
 
 void gpsOff()
 {
   pinMode(gpsPowerPin, OUTPUT);
   digitalWrite(gpsPowerPin, LOW);
+  powered = false;
 }
 
-void startGPS()
+bool gpsIsOn()
+{
+  return powered;
+}
+
+static void restartGPS()
 {
-  consoleText(F("Starting GPS..."));
-  displayText(F("Starting GPS..."));
   gpsOn();
-  gps.begin(gpsBaud);
-  
   // turn off all but GGA and RMC for MTK3339 chip
   gps.print("$PMTK314,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0*28\r\n");
+  if (fastFixes)
+    gps.print("$PMTK220,500*2B\r\n");
+}
 
-  // If no GPS characters detected in 5 seconds, this is a fatal fail
-  int charsSeen = 0;
-  bool newlineSeen = false;
-  for (time_t now = getMissionTime(); charsSeen < 100 && getMissionTime() - now < 5;)
+// GGA and RMC twice a second still leave gaps of 300 ms at 9600 baud, so
+// processGPS() reads one burst per pass either way
+void setGPSFastFixes(bool fast)
+{
+  if (fast == fastFixes)
+    return;
+  fastFixes = fast;
+  log(F("GPS: %d fixes per second\r\n"), fast ? 2 : 1);
+  if (powered)
+    gps.print(fast ? "$PMTK220,500*2B\r\n" : "$PMTK220,1000*1F\r\n");
+}
+
+void startGPS()
+{
+  startupBegin(STARTUP_GPS);
+  consoleText(F("Starting GPS...\r\n"));
+  displayText(F("Starting GPS...\r\n"));
+  gps.begin(gpsBaud);
+  restartGPS();
+}
+
+// Is the module talking?  This covers startup, which carries on meanwhile,
+// and the rest of the flight.  A silent GPS is switched off and the
+// supervisor says when to power it up again.
+static void watchGPS()
+{
+  if (!powered)
+    return;
+  int health = getHealth(SUPERVISE_GPS);
+  if (health != HEALTH_OK && tinyGps.charsProcessed() - charsAtPowerOn >= DETECT_CHARS)
   {
-    if (gps.available() > 0)
-    {
-      char c = gps.read();
-      if (c == '\r' || c == '\n')
-        newlineSeen = true;
-      if (newlineSeen)
-        consoleText(c);
-      charsSeen++;
-    }
+    if (health == HEALTH_STARTING)
+      displayText("GPS OK.\r\n");
+    reportHealthy(SUPERVISE_GPS);
+    startupDone(STARTUP_GPS);
   }
-  
-  if (charsSeen < 100)
-    fatal(BALLOON_ERR_GPS_WIRING);
-  consoleText("\r\nDone.\r\n");
-  displayText("OK.\r\n");
+  else if (millis() - lastHeard >= SILENT_MS)
+  {
+    if (health == HEALTH_STARTING)
+      displayText("GPS fail.\r\n");
+    startupDone(STARTUP_GPS, false);
+    reportFault(SUPERVISE_GPS, health == HEALTH_STARTING ? "no GPS detected (wiring?)" : "no data");
+    gpsOff();
+  }
+}
+
+// Vertical speed from the centimeter altitudes of successive fixes
+static void climb(long altitudeCm, unsigned long ms)
+{
+  static long lastCm = 0;
+  static unsigned long lastMs = 0;
+  float dt = (ms - lastMs) / 1000.0f;
+  if (info.fixCount > 1 && dt > 0 && dt < 10.0f)
+    info.verticalSpeed += CLIMB_SMOOTHING * ((altitudeCm - lastCm) / 100.0f / dt - info.verticalSpeed);
+  else
+    info.verticalSpeed = 0;
+  lastCm = altitudeCm;
+  lastMs = ms;
 }
 
 void processGPS()
 {
-  // Read from GPS until (a) 1 second has elapsed or until a break of more than 100ms has occurred
+  static time_t offSince = 0;
+
+  // In NORWAY mode, or under the tightest power budget, the GPS sleeps between fixes
+  time_t offSeconds = getModeProfile().gpsOffSeconds;
+  if (powerThrottled(PowerInfo::GPS_DUTY_CYCLE) && offSeconds < GPS_DUTY_OFF_SECONDS)
+    offSeconds = GPS_DUTY_OFF_SECONDS;
+  if (getHealth(SUPERVISE_GPS) == HEALTH_DOWN)
+  {
+    if (restartDue(SUPERVISE_GPS))
+      restartGPS();
+  }
+  else if (!powered && getMissionTime() - offSince >= offSeconds)
+  {
+    gpsOn();
+  }
+
+  // Read from GPS until (a) 1 second has elapsed or until a break of more than 100ms has occurred.
+  // If nothing has arrived yet, don't wait for it: processSleep() idles until it does.
   unsigned long start = millis();
   unsigned long timeOfLastChar = 0;
   unsigned long now = start;
   
-  while ((timeOfLastChar == 0 || now - timeOfLastChar <= 100UL) && now - start <= 1000UL)
+  while (powered && (timeOfLastChar == 0 ? gps.available() > 0 : now - timeOfLastChar <= 100UL) && now - start <= 1000UL)
   {
     if (gps.available())
     {
@@ -67,13 +147,31 @@ void processGPS()
         tinyGps.encode(gps.read());
       timeOfLastChar = millis();
     }
+    else
+    {
+      serviceDisplay(); // idle time: move display data in the background
+    }
     now = millis();
   }
+  if (timeOfLastChar != 0)
+    lastHeard = timeOfLastChar;
 
-  if (tinyGps.location.isUpdated() || tinyGps.date.isUpdated() || tinyGps.time.isUpdated())
+  // Only real progress counts, or a GPS that is off on purpose or given up on
+  if (timeOfLastChar != 0 || !powered || getHealth(SUPERVISE_GPS) == HEALTH_DOWN)
+    supervisorCheckIn(SUPERVISE_GPS);
+
+  bool newLocation = tinyGps.location.isUpdated();
+  if (newLocation || tinyGps.date.isUpdated() || tinyGps.time.isUpdated())
   {
-    info.latitude = tinyGps.location.lat();
-    info.longitude = tinyGps.location.lng();
+    info.latitude = toE7(tinyGps.location.rawLat());
+    info.longitude = toE7(tinyGps.location.rawLng());
+    if (newLocation)
+    {
+      info.fixCount++;
+      addToOdometer(track, info.latitude, info.longitude, TRACK_MIN_STEP);
+      info.trackDistance = track.meters;
+      climb(tinyGps.altitude.value(), lastHeard);
+    }
     info.year = tinyGps.date.year();
     info.month = tinyGps.date.month();
     info.day = tinyGps.date.day();
@@ -81,9 +179,9 @@ void processGPS()
     info.minute = tinyGps.time.minute();
     info.second = tinyGps.time.second();
     info.hundredths = tinyGps.time.centisecond();
-    info.altitude = tinyGps.altitude.meters();
-    info.course = tinyGps.course.deg();
-    info.speed = tinyGps.speed.knots();
+    info.altitude = tinyGps.altitude.value() / 100;     // cm
+    info.course = tinyGps.course.value() / 100.0f;  // 1/100 degrees
+    info.speed = tinyGps.speed.value() / 100.0f;    // 1/100 knots
     info.satellites = tinyGps.satellites.value();
   }
 
@@ -94,6 +192,14 @@ void processGPS()
   info.staleFix = info.fixAcquired && (tinyGps.location.age() > 2000 || tinyGps.date.age() > 2000);
   info.age = info.fixAcquired ? max(tinyGps.location.age(), tinyGps.date.age()) : (unsigned long)-1;
   info.checksumFail = tinyGps.failedChecksum();
+
+  watchGPS();
+
+  if (powered && newLocation && info.fixAcquired && offSeconds > 0)
+  {
+    gpsOff();
+    offSince = getMissionTime();
+  }
 }
 
 const struct GPSInfo &getGPSInfo()
@@ -0,0 +1,153 @@
+#include <Arduino.h>
+#include <TinyGPS++.h>
+#include "BalloonRide.h"
+
+/*
+ * Distance and bearing between positions in 1e-7 degrees
+ *
+ * Everything is single precision so the M4's FPU does the work.
+ * Coordinate differences are taken in integers first, so nothing cancels
+ * in float.  Short baselines (fix to fix, or since the last transmission)
+ * use the equirectangular approximation.  It needs only one cosine, and
+ * that is cached by latitude.  Longer baselines use haversine.  Both use
+ * TinyGPS++'s earth radius so the answers agree with what we used to get.
+ */
+
+static const float EARTH_RADIUS = 6372795.0f;       // meters, as TinyGPS++
+static const float E7_TO_RADIANS = 1.745329252e-9f; // pi / 180 / 1e7
+static const float RADIANS_TO_DEGREES = 57.29577951f;
+static const long SHORT_BASELINE = 5000000L;        // 0.5 degrees either way
+static const long COS_CACHE_STEP = 100000L;         // 0.01 degrees
+
+// Longitude difference folded into -180..180 degrees
+static long deltaLongitude(long from, long to)
+{
+  int64_t d = (int64_t)to - from;
+  if (d > 1800000000LL)
+    d -= 3600000000LL;
+  else if (d < -1800000000LL)
+    d += 3600000000LL;
+  return (long)d;
+}
+
+static bool shortBaseline(long dLat, long dLng)
+{
+  return labs(dLat) < SHORT_BASELINE && labs(dLng) < SHORT_BASELINE;
+}
+
+// The balloon doesn't change latitude fast, so the cosine rarely needs working out
+static float cosLatitude(long lat)
+{
+  static bool cached = false;
+  static long cachedLat;
+  static float cachedCos;
+  if (!cached || labs(lat - cachedLat) > COS_CACHE_STEP)
+  {
+    cached = true;
+    cachedLat = lat;
+    cachedCos = cosf(lat * E7_TO_RADIANS);
+  }
+  return cachedCos;
+}
+
+// Meters along the great circle
+float distanceBetween(long lat1, long lng1, long lat2, long lng2)
+{
+  long dLat = lat2 - lat1;
+  long dLng = deltaLongitude(lng1, lng2);
+  if (shortBaseline(dLat, dLng))
+  {
+    float x = dLng * E7_TO_RADIANS * cosLatitude(lat1 + dLat / 2);
+    float y = dLat * E7_TO_RADIANS;
+    return EARTH_RADIUS * sqrtf(x * x + y * y);
+  }
+
+  float sinHalfLat = sinf(dLat * (E7_TO_RADIANS / 2));
+  float sinHalfLng = sinf(dLng * (E7_TO_RADIANS / 2));
+  float a = sinHalfLat * sinHalfLat + cosf(lat1 * E7_TO_RADIANS) * cosf(lat2 * E7_TO_RADIANS) * sinHalfLng * sinHalfLng;
+  return 2 * EARTH_RADIUS * atan2f(sqrtf(a), sqrtf(1 - a));
+}
+
+// Initial bearing, degrees clockwise from north (0-360)
+float courseTo(long lat1, long lng1, long lat2, long lng2)
+{
+  long dLat = lat2 - lat1;
+  long dLng = deltaLongitude(lng1, lng2);
+  float course;
+  if (shortBaseline(dLat, dLng))
+  {
+    course = atan2f(dLng * cosLatitude(lat1 + dLat / 2), dLat) * RADIANS_TO_DEGREES;
+  }
+  else
+  {
+    float phi1 = lat1 * E7_TO_RADIANS, phi2 = lat2 * E7_TO_RADIANS, lambda = dLng * E7_TO_RADIANS;
+    float y = sinf(lambda) * cosf(phi2);
+    float x = cosf(phi1) * sinf(phi2) - sinf(phi1) * cosf(phi2) * cosf(lambda);
+    course = atan2f(y, x) * RADIANS_TO_DEGREES;
+  }
+  return course < 0 ? course + 360 : course;
+}
+
+// Offset a position by meters east and north (equirectangular, so keep it
+// to a few hundred km)
+void movePosition(long &lat, long &lng, float east, float north)
+{
+  long dLat = (long)(north / (EARTH_RADIUS * E7_TO_RADIANS));
+  long dLng = (long)(east / (EARTH_RADIUS * E7_TO_RADIANS * cosLatitude(lat + dLat / 2)));
+  lat = constrain(lat + dLat, -900000000L, 900000000L);
+  lng = deltaLongitude(0, lng + dLng);
+}
+
+// Add the step to a new position, once it's far enough from the last one
+// counted that GPS jitter doesn't pile up
+void addToOdometer(Odometer &odo, long lat, long lng, float minStep)
+{
+  if (odo.lat == INVALID_LATLONG || odo.lng == INVALID_LATLONG)
+  {
+    odo.lat = lat;
+    odo.lng = lng;
+    return;
+  }
+  float step = distanceBetween(odo.lat, odo.lng, lat, lng);
+  if (step < minStep)
+    return;
+  odo.fraction += step;
+  unsigned long whole = (unsigned long)odo.fraction;
+  odo.meters += whole;
+  odo.fraction -= whole;
+  odo.lat = lat;
+  odo.lng = lng;
+}
+
+// Cycles per call for each kernel, against the double precision TinyGPS++ version
+void benchmarkGeodesy()
+{
+  static const int RUNS = 100;
+  static const long LAT = 473977000L, LNG = -1223153000L; // somewhere to start from
+  volatile float sink = 0;
+  uint32_t start, cycles[4];
+
+  start = ARM_DWT_CYCCNT;
+  for (int i=0; i<RUNS; ++i)
+    sink = sink + distanceBetween(LAT, LNG, LAT + 1000L * i, LNG - 700L * i);
+  cycles[0] = ARM_DWT_CYCCNT - start;
+
+  start = ARM_DWT_CYCCNT;
+  for (int i=0; i<RUNS; ++i)
+    sink = sink + distanceBetween(LAT, LNG, LAT + 300000L * i, LNG - 7000000L * i);
+  cycles[1] = ARM_DWT_CYCCNT - start;
+
+  start = ARM_DWT_CYCCNT;
+  for (int i=0; i<RUNS; ++i)
+    sink = sink + courseTo(LAT, LNG, LAT + 300000L * i, LNG - 7000000L * i);
+  cycles[2] = ARM_DWT_CYCCNT - start;
+
+  start = ARM_DWT_CYCCNT;
+  for (int i=0; i<RUNS; ++i)
+    sink = sink + TinyGPSPlus::distanceBetween(LAT / 1e7, LNG / 1e7, (LAT + 300000L * i) / 1e7, (LNG - 7000000L * i) / 1e7);
+  cycles[3] = ARM_DWT_CYCCNT - start;
+
+  log("Geodesy cycles per call: short %lu, haversine %lu, course %lu, TinyGPS++ %lu\r\n",
+    (unsigned long)cycles[0] / RUNS, (unsigned long)cycles[1] / RUNS,
+    (unsigned long)cycles[2] / RUNS, (unsigned long)cycles[3] / RUNS);
+}
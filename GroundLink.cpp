@@ -0,0 +1,387 @@
+#include <Arduino.h>
+#include "BalloonRide.h"
+
+/*
+ * Binary ground-support protocol on the console port
+ *
+ * The BINARY console command switches the port over from text.  Each frame
+ * is COBS-encoded and ends with a zero byte:
+ *
+ *   type, sequence, payload..., CRC-16/CCITT (low byte first)
+ *
+ * The CRC covers the type, sequence and payload.  Every reply carries the
+ * sequence number of the request it answers.  While the link is up, run log
+ * lines go out as TEXT frames and the other WATCH channels are muted.
+ * Sending EXIT, or going quiet for a few minutes, returns the port to text.
+ * tools/groundlink.py is the host side.
+ *
+ * DOWNLOAD streams a log from any offset as 512-byte blocks that follow
+ * the SD card's sectors, each with its offset and a CRC-32.  Blocks go
+ * out as fast as the console ring takes them, which keeps the UART busy.
+ * If the cable drops, the receiver asks again from the last good offset.
+ */
+
+// Message types
+enum
+{
+  MSG_TELEMETRY = 1, // ->: uint16 interval ms (0 = once, 0xFFFF = stop)  <-: TelemetryFrame
+  MSG_LOG_BLOCK,     // ->: uint8 log, uint32 offset, uint16 length       <-: uint8 log, uint32 offset, uint32 size, data
+  MSG_PROFILE,       // ->: nothing                                        <-: uint32 passes, {uint32 average, worst} per section
+  MSG_COMMAND,       // ->: console or remote command text                 <-: ACK
+  MSG_ACK,           // <-: uint8 ok
+  MSG_TEXT,          // <-: run log text
+  MSG_EXIT,          // ->: nothing                                        <-: ACK, then back to text
+  MSG_DOWNLOAD       // ->: uint8 log (0 = cancel), uint32 offset           <-: uint8 log, uint32 offset, uint32 size, uint32 CRC-32, data
+};                   //     ... block after block; an empty block at the end
+
+// Everything a checkout tool wants to see, little-endian as the M4 lays it out
+struct __attribute__((packed)) TelemetryFrame
+{
+  uint32_t missionTime;
+  int32_t latitude, longitude;  // 1e-7 degrees
+  int32_t altitude;
+  uint16_t year;
+  uint8_t month, day, hour, minute, second;
+  uint8_t satellites, fixAcquired, flightState;
+  uint32_t fixCount;
+  float course, speed, trackDistance;
+  float batteryVoltage, stateOfCharge, remainingHours, loadMa;
+  float temperature[2];
+  uint32_t iridiumCount, iridiumFailures;
+  uint8_t powerLevel, mode;
+};
+
+static const int BLOCK_SIZE = 512;                          // one SD sector
+static const int BLOCK_HEADER = 13;
+static const int MAX_PAYLOAD = BLOCK_HEADER + BLOCK_SIZE;
+static const int MAX_FRAME = MAX_PAYLOAD + 4;               // type, sequence, CRC
+static const int MAX_ENCODED = MAX_FRAME + MAX_FRAME / 254 + 2;
+static const unsigned long IDLE_TIMEOUT = 5 * 60 * 1000UL;  // ms without a good frame
+
+static bool active = false;
+static uint8_t rxFrame[MAX_ENCODED];
+static int rxLength = 0;
+static unsigned long lastGoodFrame = 0;
+static unsigned long streamInterval = 0, lastStream = 0;
+static uint8_t streamSequence = 0;
+static uint8_t downloadLog = 0, downloadSequence = 0; // no download while downloadLog is 0
+static uint32_t downloadOffset = 0;
+
+// Frames are never built reentrantly, and 1.6 KB is too much stack to
+// ask of the nested ISBDCallback pass, so the buffers live here
+static uint8_t txFrame[MAX_FRAME], txEncoded[MAX_ENCODED];
+static uint8_t blockReply[MAX_PAYLOAD];                // log and download blocks
+
+static uint16_t crc16(const uint8_t *data, int length, uint16_t crc)
+{
+  while (length-- > 0)
+  {
+    crc ^= (uint16_t)*data++ << 8;
+    for (int i=0; i<8; ++i)
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+static uint32_t crc32(const uint8_t *data, int length)
+{
+  static const uint32_t nibbles[16] =
+  {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  uint32_t crc = 0xFFFFFFFF;
+  while (length-- > 0)
+  {
+    crc ^= *data++;
+    crc = (crc >> 4) ^ nibbles[crc & 0x0F];
+    crc = (crc >> 4) ^ nibbles[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+// Encode a frame so that the only zero is the delimiter at the end
+static int cobsEncode(const uint8_t *in, int length, uint8_t *out)
+{
+  int code = 0, o = 1;
+  uint8_t run = 1;
+  for (int i=0; i<length; ++i)
+  {
+    if (in[i] == 0)
+    {
+      out[code] = run;
+      code = o++;
+      run = 1;
+      continue;
+    }
+    out[o++] = in[i];
+    if (++run == 0xFF)
+    {
+      out[code] = run;
+      code = o++;
+      run = 1;
+    }
+  }
+  out[code] = run;
+  out[o++] = 0;
+  return o;
+}
+
+// Decode in place; returns the decoded length or -1 if malformed
+static int cobsDecode(uint8_t *buf, int length)
+{
+  int i = 0, o = 0;
+  while (i < length)
+  {
+    uint8_t run = buf[i++];
+    if (run == 0 || i + run - 1 > length)
+      return -1;
+    for (int j=1; j<run; ++j)
+      buf[o++] = buf[i++];
+    if (run != 0xFF && i < length)
+      buf[o++] = 0;
+  }
+  return o;
+}
+
+void sendFrame(uint8_t type, uint8_t sequence, const void *payload, int length)
+{
+  if (length > MAX_PAYLOAD)
+    length = MAX_PAYLOAD;
+  txFrame[0] = type;
+  txFrame[1] = sequence;
+  memcpy(txFrame + 2, payload, length);
+  uint16_t crc = crc16(txFrame, length + 2, 0xFFFF);
+  txFrame[length + 2] = crc & 0xFF;
+  txFrame[length + 3] = crc >> 8;
+  consoleWrite(txEncoded, cobsEncode(txFrame, length + 4, txEncoded));
+}
+
+static void sendAck(uint8_t sequence, bool ok)
+{
+  uint8_t result = ok;
+  sendFrame(MSG_ACK, sequence, &result, 1);
+}
+
+static void sendTelemetry(uint8_t sequence)
+{
+  const Telemetry &snap = getTelemetry();
+  const GPSInfo &ginf = snap.gps;
+  const BatteryInfo &binf = snap.battery;
+  const ThermalInfo &tinf = snap.thermal;
+  TelemetryFrame t;
+
+  t.missionTime = snap.time;
+  t.latitude = ginf.latitude;
+  t.longitude = ginf.longitude;
+  t.altitude = ginf.altitude;
+  t.year = ginf.year;
+  t.month = ginf.month;
+  t.day = ginf.day;
+  t.hour = ginf.hour;
+  t.minute = ginf.minute;
+  t.second = ginf.second;
+  t.satellites = ginf.satellites;
+  t.fixAcquired = ginf.fixAcquired;
+  t.flightState = snap.balloon.flightState;
+  t.fixCount = ginf.fixCount;
+  t.course = ginf.course;
+  t.speed = ginf.speed;
+  t.trackDistance = ginf.trackDistance;
+  t.batteryVoltage = binf.batteryVoltage;
+  t.stateOfCharge = binf.stateOfCharge;
+  t.remainingHours = binf.remainingHours;
+  t.loadMa = getPowerInfo().loadMa;
+  t.temperature[0] = tinf.temperature[0];
+  t.temperature[1] = tinf.temperature[1];
+  t.iridiumCount = snap.iridium.count;
+  t.iridiumFailures = snap.iridium.failcount;
+  t.powerLevel = getPowerInfo().level;
+  t.mode = getPowerMode();
+  sendFrame(MSG_TELEMETRY, sequence, &t, sizeof t);
+}
+
+static void sendLogBlock(uint8_t sequence, const uint8_t *request, int length)
+{
+  uint8_t *reply = blockReply;
+  uint32_t offset, size;
+  uint16_t wanted;
+  if (length < 7)
+  {
+    sendAck(sequence, false);
+    return;
+  }
+  memcpy(&offset, request + 1, 4);
+  memcpy(&wanted, request + 5, 2);
+  if (wanted > BLOCK_SIZE)
+    wanted = BLOCK_SIZE;
+
+  int got = readLogBlock((LOGTYPE)request[0], offset, reply + 9, wanted, &size);
+  if (got < 0)
+  {
+    sendAck(sequence, false);
+    return;
+  }
+  reply[0] = request[0];
+  memcpy(reply + 1, &offset, 4);
+  memcpy(reply + 5, &size, 4);
+  sendFrame(MSG_LOG_BLOCK, sequence, reply, 9 + got);
+}
+
+// Send the next download block (up to the next sector boundary); false at the end
+static bool sendDownloadBlock()
+{
+  uint8_t *reply = blockReply;
+  uint32_t size;
+  int wanted = BLOCK_SIZE - downloadOffset % BLOCK_SIZE;
+  int got = readLogBlock((LOGTYPE)downloadLog, downloadOffset, reply + BLOCK_HEADER, wanted, &size);
+  if (got < 0)
+  {
+    sendAck(downloadSequence, false);
+    return false;
+  }
+  uint32_t crc = crc32(reply + BLOCK_HEADER, got);
+  reply[0] = downloadLog;
+  memcpy(reply + 1, &downloadOffset, 4);
+  memcpy(reply + 5, &size, 4);
+  memcpy(reply + 9, &crc, 4);
+  sendFrame(MSG_DOWNLOAD, downloadSequence, reply, BLOCK_HEADER + got);
+  downloadOffset += got;
+  return got > 0;
+}
+
+static void sendProfile(uint8_t sequence)
+{
+  uint32_t reply[1 + 2 * PROFILE_COUNT];
+  reply[0] = profilePasses();
+  for (int i=0; i<PROFILE_COUNT; ++i)
+  {
+    reply[1 + 2 * i] = profileAverage(i);
+    reply[2 + 2 * i] = profileWorst(i);
+  }
+  sendFrame(MSG_PROFILE, sequence, reply, sizeof reply);
+}
+
+static void dispatch(const uint8_t *frame, int length)
+{
+  uint8_t type = frame[0], sequence = frame[1];
+  const uint8_t *payload = frame + 2;
+  length -= 2;
+
+  switch (type)
+  {
+    case MSG_TELEMETRY:
+      if (length >= 2)
+      {
+        uint16_t interval;
+        memcpy(&interval, payload, 2);
+        streamInterval = interval == 0xFFFF ? 0 : interval;
+        streamSequence = sequence;
+        lastStream = millis();
+      }
+      sendTelemetry(sequence);
+      break;
+    case MSG_LOG_BLOCK:
+      sendLogBlock(sequence, payload, length);
+      break;
+    case MSG_PROFILE:
+      sendProfile(sequence);
+      break;
+    case MSG_COMMAND:
+    {
+      char cmd[sizeof(IridiumInfo::receiveBuffer)];
+      if (length >= (int)sizeof cmd)
+        length = sizeof cmd - 1;
+      memcpy(cmd, payload, length);
+      cmd[length] = '\0';
+      sendAck(sequence, executeConsoleCommand(cmd));
+      break;
+    }
+    case MSG_DOWNLOAD:
+      if (length < 5 || payload[0] == 0)
+      {
+        downloadLog = 0;
+        sendAck(sequence, length >= 1);
+        break;
+      }
+      downloadLog = payload[0];
+      memcpy(&downloadOffset, payload + 1, 4);
+      downloadSequence = sequence;
+      break;
+    case MSG_EXIT:
+      sendAck(sequence, true);
+      active = false;
+      downloadLog = 0;
+      log(F("Ground link closed\r\n"));
+      break;
+    default:
+      sendAck(sequence, false);
+  }
+}
+
+void startGroundLink()
+{
+  log(F("Ground link open: binary frames from here on\r\n"));
+  active = true;
+  rxLength = 0;
+  streamInterval = 0;
+  downloadLog = 0;
+  lastGoodFrame = millis();
+}
+
+bool groundLinkActive()
+{
+  return active;
+}
+
+// Feed one received byte to the frame decoder
+void groundLinkByte(uint8_t c)
+{
+  if (c != 0)
+  {
+    if (rxLength < MAX_ENCODED)
+      rxFrame[rxLength++] = c;
+    else
+      rxLength = MAX_ENCODED + 1; // too long: discard through the next delimiter
+    return;
+  }
+
+  int length = rxLength <= MAX_ENCODED ? cobsDecode(rxFrame, rxLength) : -1;
+  rxLength = 0;
+  if (length < 4)
+    return;
+  length -= 2;
+  uint16_t crc = rxFrame[length] | (rxFrame[length + 1] << 8);
+  if (crc16(rxFrame, length, 0xFFFF) != crc)
+    return; // a frame that doesn't check out is simply ignored
+  lastGoodFrame = millis();
+  dispatch(rxFrame, length);
+}
+
+// Run log text goes out in frames while the link is up
+void groundLinkText(const char *str)
+{
+  sendFrame(MSG_TEXT, 0, str, strlen(str));
+}
+
+void processGroundLink()
+{
+  if (!active)
+    return;
+  if (downloadLog == 0 && millis() - lastGoodFrame >= IDLE_TIMEOUT)
+  {
+    active = false;
+    log(F("Ground link idle: back to text\r\n"));
+    return;
+  }
+  // Stream telemetry at the asked-for rate, but never faster than the line drains
+  if (streamInterval != 0 && millis() - lastStream >= streamInterval && consoleRoom() >= MAX_ENCODED)
+  {
+    lastStream = millis();
+    sendTelemetry(streamSequence);
+  }
+  // Keep the ring topped up with download blocks
+  while (downloadLog != 0 && consoleRoom() >= MAX_ENCODED)
+    if (!sendDownloadBlock())
+      downloadLog = 0;
+}
@@ -17,6 +17,7 @@ static struct BalloonInfo bal_info;
 static bool requestPrimary = false;
 static bool requestSecondary = false;
 static int  latestTxRxCode = ISBD_SUCCESS;
+static const float FINAL_APPROACH = 300.0; // seconds to the predicted landing when the fast cadence starts
 
 // Internal functions
 static bool decideToTransmitPrimary();
@@ -24,59 +25,113 @@ static bool decideToTransmitSecondary();
 typedef enum {PRIMARY, SECONDARY, ACK_RESPONSE, NAK_RESPONSE} PACKET_TYPE;
 typedef enum {NONE, ACK, NAK} ACK_TYPE;
 static bool txrx(const char *buf, const char *txtype, ACK_TYPE *pat);
+static void sleepModem();
+static bool beginModem();
 
 void startIridium()
 {
-  log("Setting up satmodem...");
-  displayText("Conf satmodem..");
+  startupBegin(STARTUP_IRIDIUM);
+  log("Setting up satmodem...\r\n");
+  displayText("Conf satmodem..\r\n");
   // First, start the serial port attached to the RockBLOCK
   modem.setPowerProfile(IridiumSBD::USB_POWER_PROFILE);
   iridium.begin(rockBLOCKBaud);
 
-  // ... and then the RockBLOCK itself
+  if (rockBLOCKRingPin != -1)
+    pinMode(rockBLOCKRingPin, INPUT_PULLUP);
   modem.adjustATTimeout(90);
+}
+
+// ... and then the RockBLOCK itself.  This can take the better part of
+// 90 seconds, so it's done from the loop, where ISBDCallback keeps
+// everything else going meanwhile.  If the modem won't answer we carry on
+// without it, and the supervisor says when to try again.
+static bool beginModem()
+{
+  bool starting = getHealth(SUPERVISE_IRIDIUM) == HEALTH_STARTING;
   int err = modem.begin();
+  trace(TRACE_IRIDIUM, TRACE_IRIDIUM_BEGIN, err);
   if (err != ISBD_SUCCESS)
   {
     log("modem.begin fail: %d\r\n", err);
-    displayText("fail");
-    fatal(BALLOON_ERR_IRIDIUM_INIT);
+    if (starting)
+      displayText("Satmodem fail\r\n");
+    startupDone(STARTUP_IRIDIUM, false);
+    reportFault(SUPERVISE_IRIDIUM, "modem.begin failed");
+    return false;
   }
-  log("done.\r\n");
-  displayText("OK.");
+  info.isAwake = true;
+  log("Satmodem done.\r\n");
+  if (starting)
+    displayText("Satmodem OK.\r\n");
+  startupDone(STARTUP_IRIDIUM);
+  if (getHealth(SUPERVISE_IRIDIUM) != HEALTH_DEGRADED) // only a good transmission clears that
+    reportHealthy(SUPERVISE_IRIDIUM);
+  return true;
 }
 
 
+// The snapshot stays put while txrx() runs the loop, so both messages and
+// the bookkeeping after them come from the same record
 void processIridium()
 {
-  const GPSInfo &ginf = getGPSInfo();
-  const BatteryInfo &binf = getBatteryInfo();
-  const ThermalInfo &tinf = getThermalInfo();
+  const Telemetry &t = getTelemetry();
+  const GPSInfo &ginf = t.gps;
+  const BatteryInfo &binf = t.battery;
+  const ThermalInfo &tinf = t.thermal;
   ACK_TYPE ackType = NONE;
   time_t now = getMissionTime();
 
+  // The modem has to come up first, at startup or when the supervisor says to try again
+  int health = getHealth(SUPERVISE_IRIDIUM);
+  if (health == HEALTH_STARTING || health == HEALTH_DOWN)
+  {
+    if (health == HEALTH_STARTING || restartDue(SUPERVISE_IRIDIUM))
+      beginModem();
+    return;
+  }
+
+  // Unless we're listening for RINGs, the modem sleeps between sessions
+  if (info.isAwake && !getModeProfile().listenForRing)
+    sleepModem();
+
   // Should we transmit a primary info packet?
   if (decideToTransmitPrimary())
   {
     // Create the buffer that will be sent to the RockBLOCK
     if (!ginf.fixAcquired)
     {
-      snprintf(info.transmitBuffer1, sizeof(info.transmitBuffer1),
-               "%d:no GPS,%.2f,%.2f",
-               info.rxMessageNumber, binf.batteryVoltage, tinf.temperature[0]);
+      TextWriter(info.transmitBuffer1).number(info.rxMessageNumber).text(":no GPS,")
+        .fixed(binf.batteryVoltage, 2).text(',').fixed(tinf.temperature[0], 2);
     }
 
     else
     {
-      snprintf(info.transmitBuffer1, sizeof(info.transmitBuffer1),
-               "%d:%02d%02d%02d,%.6f,%.6f,%ld,%.2f,%.2f",
-               info.rxMessageNumber % 100, ginf.hour, ginf.minute, ginf.second,
-               ginf.latitude, ginf.longitude, ginf.altitude, binf.batteryVoltage,
-               tinf.temperature[0]);
+      TextWriter(info.transmitBuffer1).number(info.rxMessageNumber % 100).text(':')
+        .number(ginf.hour, 2, '0').number(ginf.minute, 2, '0').number(ginf.second, 2, '0').text(',')
+        .coordinate(ginf.latitude, 6).text(',').coordinate(ginf.longitude, 6).text(',')
+        .number(ginf.altitude).text(',').fixed(binf.batteryVoltage, 2).text(',').fixed(tinf.temperature[0], 2);
+    }
+
+    // After an unexpected reset, say why (see BlackBox.cpp)
+    if (resetReport())
+    {
+      size_t len = strlen(info.transmitBuffer1);
+      TextWriter(info.transmitBuffer1 + len, sizeof info.transmitBuffer1 - len).text(",R:").text(resetReport());
+    }
+
+    // While descending, where and in how many minutes we expect to come down (see Landing.cpp)
+    if (t.landing.valid)
+    {
+      size_t len = strlen(info.transmitBuffer1);
+      TextWriter(info.transmitBuffer1 + len, sizeof info.transmitBuffer1 - len).text(",P:")
+        .coordinate(t.landing.latitude, 4).text(',').coordinate(t.landing.longitude, 4).text(',')
+        .number((long)(t.landing.timeToGround / 60));
     }
 
     if (txrx(info.transmitBuffer1, "Primary", &ackType))
     {
+      resetReported();
       info.xmitTime1 = now;
       info.alt = ginf.altitude;
       info.lat = ginf.latitude;
@@ -88,16 +143,32 @@ void processIridium()
   // Should we transmit a secondary info packet?
   if (decideToTransmitSecondary())
   {
-    // external temp, ballast, satellites, course, speed
-    snprintf(info.transmitBuffer2, sizeof(info.transmitBuffer2),
-             "S%d:%.2f,%d,%.2f,%.2f,0,0",
-             info.rxMessageNumber, tinf.temperature[0],
-             ginf.satellites, ginf.course, ginf.speed);
+    // The interval since the last one: snapshots; external temp mean,min,max,sd;
+    // fewest satellites; mean course; speed mean,min,max,sd; lowest battery
+    IntervalStats s = getIntervalStats(INTERVAL_SECONDARY);
+    TextWriter secondary(info.transmitBuffer2);
+    secondary.text('S').number(info.rxMessageNumber).text(':').number(s.samples).text(',')
+      .statistic(s.temperature[1], 1).text(',');
+    if (s.satellites.count > 0)
+      secondary.number((int)s.satellites.min);
+    secondary.text(',');
+    if (s.speed.count > 0)
+      secondary.number((int)(meanCourse(s) + 0.5f) % 360);
+    secondary.text(',').statistic(s.speed, 1).text(',');
+    if (s.battery.count > 0)
+      secondary.fixed(s.battery.min, 2);
+
+    // Snapshots that arrive during the call belong to the next interval
+    resetIntervalStats(INTERVAL_SECONDARY);
     if (txrx(info.transmitBuffer2, "Secondary", &ackType))
     {
       info.xmitTime2 = now;
       requestSecondary = false;
     }
+    else
+    {
+      mergeIntervalStats(INTERVAL_SECONDARY, s);
+    }
   }
 
 #if false // decided 1/18 not to send confusing ACK messages
@@ -141,8 +212,9 @@ static bool decideToTransmitPrimary()
   bal_info.isDescending = false;
 
   bool mustTransmit = false;
-  bool ringAsserted = modem.hasRingAsserted();
-  const GPSInfo &ginf = getGPSInfo();
+  bool ringAsserted = getModeProfile().listenForRing && rockBLOCKRingPin != -1 && digitalRead(rockBLOCKRingPin) == LOW;
+  const GPSInfo &ginf = getTelemetry().gps;
+  const LandingInfo &landing = getTelemetry().landing;
 
   // Don't transmit in the first 5 minutes unless we have a fix
   if (now < 5 * 60 && !ginf.fixAcquired)
@@ -162,11 +234,11 @@ static bool decideToTransmitPrimary()
     if (info.xmitTime1 != 0UL && info.lat != INVALID_LATLONG && info.lng != INVALID_LATLONG && info.alt != INVALID_ALTITUDE)
     {
       // ... and whether the balloon has moved significantly since the last transmission
-      bal_info.lateralTravel = TinyGPSPlus::distanceBetween(ginf.latitude, ginf.longitude, info.lat, info.lng);
+      bal_info.lateralTravel = distanceBetween(ginf.latitude, ginf.longitude, info.lat, info.lng);
       bal_info.verticalTravel = abs(info.alt - ginf.altitude);
 
       // If it's moved since the most recent transmission, it's in flight
-      if (bal_info.lateralTravel > 1000.0 || bal_info.verticalTravel > 100UL)
+      if (bal_info.lateralTravel > 1000.0f || bal_info.verticalTravel > 100UL)
       {
         bal_info.flightState = BalloonInfo::INFLIGHT;
       }
@@ -182,8 +254,14 @@ static bool decideToTransmitPrimary()
   }
 
   // Here are the cases when we should transmit a message on the sat modem:
+  // 0. In NORWAY mode nothing but a client request wakes the modem more often than every so often...
+  if (!requestPrimary && info.xmitTime1 != 0UL && secsSinceLastXmit < getModeProfile().minPrimaryInterval * 60L)
+  {
+    mustTransmit = false;
+  }
+
   // 1. If the client requested it...
-  if (requestPrimary)
+  else if (requestPrimary)
   {
     log(F("Primary info requested by client..\r\n"));
     mustTransmit = true;
@@ -210,10 +288,10 @@ static bool decideToTransmitPrimary()
     mustTransmit = true;
   }
 
-  // 5. If the balloon is descending and is close to the ground, transmit as frequently as possible.
-  //    This probably indicates that the balloon is about to land.  If it does so upside-down or in water and cannot
+  // 5. If the balloon is predicted to be on the ground within FINAL_APPROACH (or, with no prediction, is descending
+  //    and close to the ground), transmit as frequently as possible.  If it lands upside-down or in water and cannot
   //    transmit after touching down, this strategy may help us find the payload.
-  else if (bal_info.isDescending && ginf.altitude < bal_info.groundAltitude + 1000L)
+  else if (landing.valid ? landing.timeToGround < FINAL_APPROACH : bal_info.isDescending && ginf.altitude < bal_info.groundAltitude + 1000L)
   {
     log(F("Just about to land: transmitting as frequently as possible.\r\n"));
     mustTransmit = true;
@@ -254,7 +332,7 @@ static bool decideToTransmitSecondary()
   }
 
   // 2. If it's been a while (0 = never transmit)
-  if (info.SECONDARY_INTERVAL != 0 && secsSinceLastXmit >= info.SECONDARY_INTERVAL * 60L)
+  if (info.SECONDARY_INTERVAL != 0 && secsSinceLastXmit >= info.SECONDARY_INTERVAL * 60L && !powerThrottled(PowerInfo::NO_SECONDARY))
   {
     log(F("It's been %d minutes since last secondary: time to transmit.\r\n"), info.SECONDARY_INTERVAL);
     mustTransmit = true;
@@ -276,12 +354,10 @@ static bool txrx(const char *buffer, const char *txtype, ACK_TYPE *pat)
   if (modem.isAsleep())
   {
     log(F("Waking modem.\r\n"));
-    int err = modem.begin();
-    if (err != ISBD_SUCCESS)
+    if (!beginModem())
     {
-      log("modem.begin fail: %d\r\n", err);
-      displayText("fail");
-      fatal(BALLOON_ERR_IRIDIUM_INIT);
+      info.failcount++;
+      return false;
     }
     delay(2000); // needed??
   }
@@ -291,10 +367,12 @@ static bool txrx(const char *buffer, const char *txtype, ACK_TYPE *pat)
   info.isTransmitting = true;
   latestTxRxCode = modem.sendReceiveSBDText(buffer, reinterpret_cast<uint8_t *>(info.receiveBuffer), rxBufSize);
   info.isTransmitting = false;
+  trace(TRACE_IRIDIUM, TRACE_IRIDIUM_SENDRECEIVE, latestTxRxCode);
   if (latestTxRxCode == ISBD_SUCCESS)
   {
     info.count++;
     log(F("TX succeeded.\r\n"));
+    reportHealthy(SUPERVISE_IRIDIUM);
     if (info.receiveBuffer[0])
     {
       info.receiveBuffer[rxBufSize] = '\0';
@@ -305,26 +383,35 @@ static bool txrx(const char *buffer, const char *txtype, ACK_TYPE *pat)
     }
     *pat = NONE;
   
-    /* New */
-    int err = modem.sleep();
-    if (err != ISBD_SUCCESS)
-    {
-      log("modem.sleep fail: %d\r\n", err);
-      displayText("fail");
-      // fatal(BALLOON_ERR_IRIDIUM_INIT);
-    }
-    
-    /* New */
+    if (!getModeProfile().listenForRing)
+      sleepModem();
     return true;
   }
   else
   {
     info.failcount++;
     log(F("TX failed: %d\r\n"), latestTxRxCode);
+    reportDegraded(SUPERVISE_IRIDIUM, "transmission failed");
     return false;
   }
 }
 
+static void sleepModem()
+{
+  int err = modem.sleep();
+  trace(TRACE_IRIDIUM, TRACE_IRIDIUM_SLEEP, err);
+  if (err != ISBD_SUCCESS)
+  {
+    log("modem.sleep fail: %d\r\n", err);
+    displayText("fail");
+    // fatal(BALLOON_ERR_IRIDIUM_INIT);
+  }
+  else
+  {
+    info.isAwake = false;
+  }
+}
+
 void setFlightInterval(uint16_t interval)
 {
   info.FLIGHT_INTERVAL = interval;
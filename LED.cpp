@@ -7,10 +7,13 @@
 
 void blink(int count);
 
+static const unsigned long HELLO_MS = 800; // two blinks
+static unsigned long helloStart = 0;
+
 void startLED()
 {
   pinMode(ledPin, OUTPUT);
-  blink(2); // Hello, world!
+  helloStart = millis(); // Hello, world! (processLED does the blinking)
 }
 
 // Blink the LED "count" times.
@@ -51,11 +54,15 @@ void processLED()
   // fix? on
   bool on;
 
-  if (getIridiumInfo().isTransmitting)
+  if (millis() - helloStart < HELLO_MS)
+  {
+    on = (millis() - helloStart) / 200 % 2 == 0;
+  }
+  else if (getTelemetry().iridium.isTransmitting)
   {
     on = getMissionTime() % 2 == 1;
   }
-  else if (getGPSInfo().fixAcquired)
+  else if (getTelemetry().gps.fixAcquired)
   {
     on = true;
   }
@@ -0,0 +1,135 @@
+#include <Arduino.h>
+#include "BalloonRide.h"
+
+/*
+ * Landing-point prediction
+ *
+ * On the way up the balloon drifts with the wind, so each fix's ground
+ * velocity is the wind at that altitude.  It goes into a profile of
+ * BAND_METERS altitude bands.  On the way down each fix re-runs the
+ * descent: from the current altitude to the ground (the launch site's
+ * altitude, for want of better), band by band, the time spent in the band
+ * times its wind is the drift.  The current band uses the velocity seen
+ * right now, and a band with no wind on record takes the one above it.
+ *
+ * Under a parachute the fall rate goes as 1/sqrt(air density), so it is
+ * modelled as a sea-level rate times exp(h / 2H).  The sea-level rate
+ * starts at a typical 5 m/s and is then fitted to the descent actually
+ * seen.
+ *
+ * The prediction rides on primary messages once we're descending.  The
+ * time to the ground sets when the modem switches to the fast cadence for
+ * the final approach.
+ */
+
+static const long BAND_METERS = 500;
+static const int BANDS = 80;                    // to 40 km
+static const float SCALE_HEIGHT = 7200.0f;      // m, of air density
+static const float RATE_SMOOTHING = 0.1f;
+static const float DESCENDING = -2.0f;          // m/s: falling, not just bobbing
+static const float CLIMBING = 0.5f;             // m/s: not descending any more
+static const float KNOTS_TO_MS = 0.514444f;
+static const float DEGREES_TO_RADIANS = 0.01745329252f;
+
+static struct
+{
+  float east, north;                            // sums of m/s
+  uint16_t count;
+} bands[BANDS];
+static LandingInfo info;
+static bool descending = false;
+static unsigned long lastFix = 0;
+
+static int bandOf(long altitude)
+{
+  return constrain(altitude / BAND_METERS, 0L, (long)BANDS - 1);
+}
+
+static float fallRate(float altitude)
+{
+  return info.seaLevelRate * expf(altitude / (2 * SCALE_HEIGHT));
+}
+
+// Fall from here to the ground through the wind profile
+static void predict(const GPSInfo &ginf, float east, float north, long ground)
+{
+  float driftEast = 0, driftNorth = 0, seconds = 0;
+  float top = ginf.altitude;
+  int start = bandOf(ginf.altitude);
+  for (int i=start; i>=0 && top > ground; --i)
+  {
+    float bottom = max((float)(i * BAND_METERS), (float)ground);
+    if (i != start && bands[i].count > 0)
+    {
+      east = bands[i].east / bands[i].count;
+      north = bands[i].north / bands[i].count;
+    }
+    float dt = (top - bottom) / fallRate((top + bottom) / 2);
+    driftEast += east * dt;
+    driftNorth += north * dt;
+    seconds += dt;
+    top = bottom;
+  }
+
+  info.latitude = ginf.latitude;
+  info.longitude = ginf.longitude;
+  movePosition(info.latitude, info.longitude, driftEast, driftNorth);
+  info.timeToGround = seconds;
+}
+
+// Once per new fix
+void processLanding()
+{
+  const GPSInfo &ginf = getGPSInfo();
+  if (ginf.fixCount == lastFix || !ginf.fixAcquired || ginf.staleFix)
+    return;
+  lastFix = ginf.fixCount;
+
+  const BalloonInfo &binf = getBalloonInfo();
+  bool flying = binf.flightState == BalloonInfo::INFLIGHT;
+  if (ginf.verticalSpeed < DESCENDING && flying)
+    descending = true;
+  else if (ginf.verticalSpeed > CLIMBING || !flying)
+    descending = false;
+
+  float speed = ginf.speed * KNOTS_TO_MS;
+  float east = speed * sinf(ginf.course * DEGREES_TO_RADIANS);
+  float north = speed * cosf(ginf.course * DEGREES_TO_RADIANS);
+  if (flying && !descending)
+  {
+    int band = bandOf(ginf.altitude);
+    bands[band].east += east;
+    bands[band].north += north;
+    if (bands[band].count < 65535)
+      ++bands[band].count;
+  }
+
+  info.valid = descending;
+  if (!descending)
+    return;
+  info.seaLevelRate += RATE_SMOOTHING * (-ginf.verticalSpeed / expf(ginf.altitude / (2 * SCALE_HEIGHT)) - info.seaLevelRate);
+  predict(ginf, east, north, binf.groundAltitude != INVALID_ALTITUDE ? binf.groundAltitude : 0);
+}
+
+const LandingInfo &getLandingInfo()
+{
+  return info;
+}
+
+void showLanding()
+{
+  if (info.valid)
+    log(F("Landing predicted at %.5f,%.5f in %lu s\r\n"), info.latitude / 1e7, info.longitude / 1e7, (unsigned long)info.timeToGround);
+  else
+    log(F("No landing prediction (not descending)\r\n"));
+  log(F("Fall rate %.1f m/s at sea level\r\nWind profile:\r\n"), info.seaLevelRate);
+  for (int i=BANDS-1; i>=0; --i)
+  {
+    if (bands[i].count == 0)
+      continue;
+    float east = bands[i].east / bands[i].count, north = bands[i].north / bands[i].count;
+    float from = atan2f(-east, -north) * 57.29577951f; // meteorological: where it blows from
+    log("  %5ld-%5ld m %5.1f m/s from %03d (%u fixes)\r\n", i * BAND_METERS, (i + 1) * BAND_METERS,
+      sqrtf(east * east + north * north), (int)(from < 0 ? from + 360 : from) % 360, bands[i].count);
+  }
+}
@@ -10,12 +10,21 @@
 // File objects
 static SdFatSdio sd;
 static File RunLog, TelemetryLog/*, IridiumLog*/;
+static bool readerStale = true;   // logs synced since the ground link reader opened
+
+// A descending record with every field at its widest (8 digit floats, 32 bit
+// extremes), both Iridium messages full, all the probes and every optional
+// block comes to 1446 bytes
+static const size_t LOG_RECORD_SIZE = 1536;
+static const char LOG_RECORD_END[] = " />\r\n";
 
 static bool sdfail = false;
 bool SDFail() { return sdfail; }
 
 void startLogs()
 {
+  startupBegin(STARTUP_LOGS);
+  startupBegin(STARTUP_TELEMETRY);
   consoleText("Checking SD...");
   displayText("Checking SD...");
 
@@ -25,6 +34,7 @@ void startLogs()
     displayText("fail.\r\n");
     // fatal(BALLOON_ERR_SD_INIT);
     sdfail = true;
+    startupDone(STARTUP_LOGS, false);
     return;
   }
   
@@ -53,9 +63,9 @@ void startLogs()
     consoleText("Couldn't create directory.\r\n");
     displayText("fail2.\r\n");
     displayText(dirname);
-    delay(2000);
     // fatal(BALLOON_ERR_SD_INIT);
     sdfail = true;
+    startupDone(STARTUP_LOGS, false);
     return;
   }
   
@@ -71,75 +81,111 @@ void startLogs()
     displayText("fail3.\r\n");
     // fatal(BALLOON_ERR_LOG_FILE);
     sdfail = true;
+    startupDone(STARTUP_LOGS, false);
     return;
   }
 
   consoleText("done.\r\n");
   displayText("OK.\r\n");
+  startupDone(STARTUP_LOGS);
 }
 
 void processLogs()
 {
   static unsigned long lastLogTime = 0UL;
-  unsigned long now = getMissionTime();
+  const Telemetry &t = getTelemetry();
+  unsigned long now = t.time; // moves only when a new snapshot is published
 
-  // Do logging stuff once per second
-  if (now != lastLogTime)
+  // Do logging stuff once per second (less often in NORWAY mode)
+  if (now - lastLogTime >= (unsigned long)getModeProfile().logInterval)
   {
     // First, create a new record for the telemetry log
-    const GPSInfo &ginf = getGPSInfo();
-    const BatteryInfo &binf = getBatteryInfo();
-    const ThermalInfo &tinf = getThermalInfo();
-    const IridiumInfo &iinf = getIridiumInfo();
-    const BalloonInfo &balinf = getBalloonInfo();
+    const GPSInfo &ginf = t.gps;
+    const BatteryInfo &binf = t.battery;
+    const ThermalInfo &tinf = t.thermal;
+    const IridiumInfo &iinf = getIridiumInfo(); // for the message text
+    const BalloonInfo &balinf = t.balloon;
     
     lastLogTime = now;
-    char logBuffer[500] = "";
-    snprintf(logBuffer, sizeof(logBuffer),
-      "<LOG time=\"%lu\" batt=\"%.2f\" T-int=\"%.2f\" T-ext=\"%.2f\" G-fix=\"%s\" G-loc=\"%.6f,%.6f\" G-alt=\"%ld\" "
-      "G-time=\"%04d-%02d-%02d %02d:%02d:%02d\" G-chk-fail=\"%lu\" I-xmit=\"%ld\" I-fail=\"%ld\" "
-      "I-msg1=\"%s\" G-sats=\"%d\" G-age=\"%ld\" I-age=\"%ld\" I-msg2=\"%s\" G-speed=\"%.2f\" G-course=\"%03d\" "
-      "B-ground=\"%ld\" B-maxalt=\"%ld\" B-state=\"%s\" B-descend=\"%s\" B-horiz=\"%.2f\" B-vert=\"%lu\" />\r\n",
-      now,
-      binf.batteryVoltage,
-      tinf.temperature[0],
-      tinf.temperature[1],
-      ginf.fixAcquired ? "true" : "false",
-      ginf.latitude,
-      ginf.longitude,
-      ginf.altitude,
-      ginf.year,
-      ginf.month,
-      ginf.day,
-      ginf.hour,
-      ginf.minute,
-      ginf.second,
-      ginf.checksumFail,
-      iinf.count,
-      iinf.failcount,
-      iinf.transmitBuffer1,
-      ginf.satellites,
-      ginf.age,
-      now - iinf.xmitTime1,
-      iinf.transmitBuffer2,
-      ginf.speed,
-      (int)ginf.course,
-      balinf.groundAltitude,
-      balinf.maxAltitude,
-      balinf.flightState == BalloonInfo::INFLIGHT ? "flight" : balinf.flightState == BalloonInfo::LANDED ? "landed" : "ground",
-      balinf.isDescending ? "true" : "false",
-      balinf.lateralTravel,
-      balinf.verticalTravel);
+    static char logBuffer[LOG_RECORD_SIZE];
+    TextWriter record(logBuffer, sizeof logBuffer - strlen(LOG_RECORD_END)); // the end always fits
+    record.text("<LOG time=\"").number(now)
+      .text("\" batt=\"").fixed(binf.batteryVoltage, 2)
+      .text("\" batt-soc=\"").fixed(binf.stateOfCharge, 0)
+      .text("\" batt-hrs=\"").fixed(binf.remainingHours, 1)
+      .text("\" T-int=\"").fixed(tinf.temperature[0], 2)
+      .text("\" T-ext=\"").fixed(tinf.temperature[1], 2)
+      .text("\" G-fix=\"").text(ginf.fixAcquired ? "true" : "false")
+      .text("\" G-loc=\"").coordinate(ginf.latitude, 6).text(',').coordinate(ginf.longitude, 6)
+      .text("\" G-alt=\"").number(ginf.altitude)
+      .text("\" G-time=\"").timestamp(ginf.year, ginf.month, ginf.day, ginf.hour, ginf.minute, ginf.second)
+      .text("\" G-chk-fail=\"").number(ginf.checksumFail)
+      .text("\" I-xmit=\"").number(t.iridium.count)
+      .text("\" I-fail=\"").number(t.iridium.failcount)
+      .text("\" I-msg1=\"").text(iinf.transmitBuffer1)
+      .text("\" G-sats=\"").number(ginf.satellites)
+      .text("\" G-age=\"").number(ginf.age)
+      .text("\" I-age=\"").number((long)(now - t.iridium.xmitTime1))
+      .text("\" I-msg2=\"").text(iinf.transmitBuffer2)
+      .text("\" G-speed=\"").fixed(ginf.speed, 2)
+      .text("\" G-course=\"").number((int)ginf.course, 3, '0')
+      .text("\" B-ground=\"").number(balinf.groundAltitude)
+      .text("\" B-maxalt=\"").number(balinf.maxAltitude)
+      .text("\" B-state=\"").text(balinf.flightState == BalloonInfo::INFLIGHT ? "flight" : balinf.flightState == BalloonInfo::LANDED ? "landed" : "ground")
+      .text("\" B-descend=\"").text(balinf.isDescending ? "true" : "false")
+      .text("\" B-horiz=\"").fixed(balinf.lateralTravel, 2)
+      .text("\" B-vert=\"").number(balinf.verticalTravel)
+      .text("\" G-track=\"").number(ginf.trackDistance)
+      .text('"');
+
+    // Summaries (mean,min,max,sd) of everything since the last record,
+    // unless that was a single snapshot and the record already says it all
+    const IntervalStats &stats = getIntervalStats(INTERVAL_LOG);
+    if (stats.samples > 1)
+      record.text(" S-n=\"").number(stats.samples)
+        .text("\" S-T-int=\"").statistic(stats.temperature[0], 2)
+        .text("\" S-T-ext=\"").statistic(stats.temperature[1], 2)
+        .text("\" S-batt=\"").statistic(stats.battery, 2)
+        .text("\" S-G-alt=\"").statistic(stats.altitude, 0)
+        .text("\" S-G-speed=\"").statistic(stats.speed, 2)
+        .text("\" S-G-sats=\"").statistic(stats.satellites, 1)
+        .text('"');
+    resetIntervalStats(INTERVAL_LOG);
+
+    // Any probes beyond the internal and external ones
+    for (int i=2; i<tinf.probeCount; ++i)
+      record.text(" T-").number(i).text("=\"").fixed(tinf.temperature[i], 2).text('"');
+    // Altitude controller state, while it's running
+    const AltitudeControlInfo &ainf = getAltitudeControlInfo();
+    if (ainf.active)
+      record.text(" A-target=\"").number(ainf.target)
+        .text("\" A-alt=\"").fixed(ainf.altitude, 1)
+        .text("\" A-vs=\"").fixed(ainf.verticalSpeed, 2)
+        .text("\" A-want=\"").fixed(ainf.wantedSpeed, 2)
+        .text("\" A-int=\"").fixed(ainf.integral, 2)
+        .text("\" A-out=\"").fixed(ainf.output, 2)
+        .text('"');
+    // Landing prediction, while descending
+    const LandingInfo &linf = t.landing;
+    if (linf.valid)
+      record.text(" L-loc=\"").coordinate(linf.latitude, 6).text(',').coordinate(linf.longitude, 6)
+        .text("\" L-secs=\"").number((long)linf.timeToGround) // whole seconds, at most 11 characters
+        .text("\" L-rate=\"").fixed(linf.seaLevelRate, 2)
+        .text('"');
+    strcpy(logBuffer + record.length(), LOG_RECORD_END);
 
     TelemetryLog.print(logBuffer);
     RunLog.print(logBuffer);
     if (getConsoleViewFlags() & (LOG_TELEMETRY | LOG_RUNLOG))
-      consoleText(logBuffer);
+      consoleText(logBuffer, LOG_TELEMETRY);
 
     // Then flush all the logs in case the system halts for some reason
     RunLog.sync();
     TelemetryLog.sync();
     //IridiumLog.sync();
+    readerStale = true;
+    startupDone(STARTUP_TELEMETRY); // only the first record counts
+    supervisorCheckIn(SUPERVISE_LOGS);
   }
 }
 
@@ -154,7 +200,7 @@ void log(const char *fmt, ...)
  
   RunLog.print(buf);
   if (getConsoleViewFlags() & LOG_RUNLOG)
-    consoleText(buf);
+    consoleText(buf, LOG_RUNLOG);
 }
 
 extern void log(FlashString fmt, ...)
@@ -166,14 +212,14 @@ extern void log(FlashString fmt, ...)
  
   RunLog.print(buf);
   if (getConsoleViewFlags() & LOG_RUNLOG)
-    consoleText(buf);
+    consoleText(buf, LOG_RUNLOG);
 }
 
 void log(char c)
 {
   RunLog.write(c);
   if (getConsoleViewFlags() & LOG_RUNLOG)
-    consoleText(c);
+    consoleText(c, LOG_RUNLOG);
 }
 
 void iridiumLog(char c)
@@ -181,7 +227,38 @@ void iridiumLog(char c)
   //IridiumLog.write(c);
   RunLog.write(c);
   if (getConsoleViewFlags() & LOG_IRIDIUM)
-    consoleText(c);
+    consoleText(c, LOG_IRIDIUM);
+}
+
+// Read part of a log for the ground link; returns the byte count, or -1.
+// The file stays open between calls so a download isn't reopening it for
+// every block.  A reader only sees the size the directory entry had when it
+// was opened, so it's reopened when the log changes or after every sync,
+// and *size is never older than the last sync.
+int readLogBlock(LOGTYPE whichLog, uint32_t offset, uint8_t *dest, int length, uint32_t *size)
+{
+  static File reader;
+  static LOGTYPE readerLog;
+  static uint32_t readerSize = 0;
+
+  if (sdfail)
+    return -1;
+  if (!reader.isOpen() || whichLog != readerLog || readerStale)
+  {
+    if (reader.isOpen())
+      reader.close();
+    if (!reader.open(whichLog == LOG_TELEMETRY ? "telemetry.log" : "run.log", O_READ))
+      return -1;
+    readerLog = whichLog;
+    readerSize = reader.fileSize();
+    readerStale = false;
+  }
+  *size = readerSize;
+  if (offset >= readerSize)
+    return 0;
+  if (reader.curPosition() != offset && !reader.seekSet(offset))
+    return -1;
+  return reader.read(dest, length);
 }
 
 void showLog(LOGTYPE whichLog)
@@ -201,7 +278,11 @@ void showLog(LOGTYPE whichLog)
   consoleText("\r\n");
   consoleText(F("*************************************\r\n"));
   while (log.available())
+  {
     consoleText((char)log.read());
+    if (log.curPosition() % 512 == 0)
+      feedWatchdog(); // nothing else runs while the operator reads the log
+  }
   consoleText(F("*************************************\r\n"));
 
   log.close();
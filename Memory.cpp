@@ -0,0 +1,129 @@
+#include <Arduino.h>
+#include "BalloonRide.h"
+
+/*
+ * Stack high-water marks and the RAM budget
+ *
+ * The stack grows down from the top of RAM toward the heap.  While the
+ * modem is busy, loop() runs again from inside the IridiumSBD library
+ * (ISBDCallback), so a whole second pass sits on top of the modem's call
+ * chain.  setup() paints everything between the heap and the stack
+ * pointer; the lowest word that isn't paint any more is the deepest the
+ * stack has been.
+ *
+ * Whenever a stack context ends (setup, an outer loop pass, a nested pass),
+ * the few words just under the known low point are checked.  If they've been
+ * written, the stack has gone deeper, so we rescan and charge the new low
+ * point to that context.  Interrupts share the same stack and are charged to
+ * whichever context they interrupted.
+ *
+ * Static RAM (data, noinit, bss) comes from the linker's symbols.  The
+ * per-module breakdown needs the link map: see tools/rambudget.py.
+ */
+
+extern unsigned long _sdata, _edata, _sbss, _ebss, _estack;
+extern char *__brkval; // top of the heap (see _sbrk)
+
+static const uint32_t PAINT = 0xC5AC5AC5UL;
+static const uint32_t RAM_SIZE = 256UL * 1024;  // Teensy 3.5
+static const int PROBE_WORDS = 8;               // how far under the low point to look on each check
+static const uint32_t STACK_WARNING = 4096;     // bytes of headroom worth shouting about
+
+static const char *contextNames[STACK_CONTEXTS] = {"setup", "loop", "Iridium nested"};
+static struct
+{
+  uint32_t entryDepth; // deepest the stack was on the way in
+  uint32_t maxDepth;   // deepest it went before the context ended
+} contexts[STACK_CONTEXTS];
+static uint32_t *lowest;  // lowest stack word known to have been used
+static bool warned = false;
+
+static uint32_t *stackTop()
+{
+  return (uint32_t *)&_estack;
+}
+
+// Heap top, rounded up to a word
+static uint32_t *heapTop()
+{
+  return (uint32_t *)(((uint32_t)__brkval + 3) & ~3UL);
+}
+
+static uint32_t depthOf(const void *p)
+{
+  return (uint32_t)((const char *)stackTop() - (const char *)p);
+}
+
+// Call first thing in setup()
+void paintStack()
+{
+  uint32_t *sp = (uint32_t *)__builtin_frame_address(0) - 16; // leave our own frame alone
+  for (uint32_t *p = heapTop(); p < sp; ++p)
+    *p = PAINT;
+  lowest = sp;
+  stackEntry(STACK_SETUP);
+}
+
+// Lowest word that isn't paint, counting up from the heap
+static uint32_t *scanStack()
+{
+  uint32_t *p = heapTop();
+  while (p < lowest && *p == PAINT)
+    ++p;
+  return p;
+}
+
+void stackEntry(int context)
+{
+  uint32_t depth = depthOf(__builtin_frame_address(0));
+  if (depth > contexts[context].entryDepth)
+    contexts[context].entryDepth = depth;
+}
+
+void stackCheck(int context)
+{
+  bool deeper = false;
+  for (int i=1; i<=PROBE_WORDS && lowest - i >= heapTop(); ++i)
+    if (lowest[-i] != PAINT)
+      deeper = true;
+  if (!deeper)
+    return;
+
+  lowest = scanStack();
+  uint32_t depth = depthOf(lowest);
+  if (depth > contexts[context].maxDepth)
+    contexts[context].maxDepth = depth;
+
+  uint32_t headroom = (uint32_t)((char *)lowest - (char *)heapTop());
+  if (headroom < STACK_WARNING && !warned)
+  {
+    warned = true;
+    log(F("WARNING: stack is within %lu bytes of the heap (in %s)\r\n"), headroom, contextNames[context]);
+  }
+}
+
+void showMemory()
+{
+  lowest = scanStack(); // the quick checks can miss a deep call that skipped over an untouched buffer
+  uint32_t data = (uint32_t)&_edata - (uint32_t)&_sdata;
+  uint32_t noinit = (uint32_t)&_sbss - (uint32_t)&_edata;
+  uint32_t bss = (uint32_t)&_ebss - (uint32_t)&_sbss;
+  uint32_t heap = (uint32_t)__brkval - (uint32_t)&_ebss;
+  uint32_t stack = depthOf(lowest);
+  uint32_t ramStart = (uint32_t)stackTop() - RAM_SIZE;
+  uint32_t other = (uint32_t)&_sdata - ramStart; // USB descriptors and DMA buffers
+  uint32_t untouched = (uint32_t)((char *)lowest - (char *)heapTop());
+
+  log(F("RAM (bytes of %lu):\r\n"), RAM_SIZE);
+  log("  %-16s %7lu\r\n", "USB/DMA", other);
+  log("  %-16s %7lu\r\n", "data", data);
+  log("  %-16s %7lu\r\n", "noinit", noinit);
+  log("  %-16s %7lu\r\n", "bss", bss);
+  log("  %-16s %7lu\r\n", "heap", heap);
+  log("  %-16s %7lu (deepest)\r\n", "stack", stack);
+  log("  %-16s %7lu never touched\r\n", "free", untouched);
+  log(F("Stack by context (bytes below the top):\r\n"));
+  log("  %-16s %7s %7s\r\n", "", "entry", "deepest");
+  for (int i=0; i<STACK_CONTEXTS; ++i)
+    log("  %-16s %7lu %7lu\r\n", contextNames[i], contexts[i].entryDepth, contexts[i].maxDepth);
+}
@@ -0,0 +1,109 @@
+#include <Arduino.h>
+#include "BalloonRide.h"
+
+/*
+ * Central energy budget governor.
+ *
+ * Once a second we add up the modelled draw of every load (CPU, GPS, modem,
+ * display, camera) and feed the smoothed total to the battery model.  We
+ * also compare the hours the battery has left against the hours the mission
+ * has left and step the throttle level up or down, at most once every few
+ * minutes so the model can settle between changes.  Each level sheds
+ * one more non-essential load: secondary messages, then the display, then
+ * most of the pictures, and finally the GPS duty cycle.
+ */
+
+static PowerInfo info;
+static const float LOAD_SMOOTHING = 1.0 / 600; // ~10-minute average
+static const float HEADROOM = 1.2;             // hysteresis before relaxing a level
+static const time_t LEVEL_INTERVAL = 5 * 60;    // let the model settle between changes
+static const char *levelNames[] = {"full", "no secondary", "no display", "fewer pictures", "GPS duty cycle"};
+static const char *loadNames[] = {"CPU", "GPS", "modem", "display", "camera"};
+
+void startPower()
+{
+  log(F("Starting power governor (mission target %.0f h)\r\n"), MISSION_HOURS);
+  info.averageLoadMa = DEFAULT_LOAD_MA;
+}
+
+static void setLevel(int level, float batteryHours, float missionHours)
+{
+  log(F("Power governor: %s -> %s (battery %.1f h, mission %.1f h)\r\n"),
+    levelNames[info.level], levelNames[level], batteryHours, missionHours);
+  info.level = level;
+}
+
+// Decide whether to shed or restore a load
+static void govern()
+{
+  static time_t lastChange = 0;
+  time_t now = getMissionTime();
+  const BatteryInfo &binf = getBatteryInfo();
+
+  if (binf.remainingHours < 0 || now - lastChange < LEVEL_INTERVAL)
+    return;
+
+  float missionHours = MISSION_HOURS - now / 3600.0f;
+  if (missionHours < 0)
+    missionHours = 0;
+
+  if (binf.remainingHours < missionHours && info.level < PowerInfo::GPS_DUTY_CYCLE)
+  {
+    setLevel(info.level + 1, binf.remainingHours, missionHours);
+    lastChange = now;
+  }
+  else if (binf.remainingHours > missionHours * HEADROOM && info.level > PowerInfo::FULL)
+  {
+    setLevel(info.level - 1, binf.remainingHours, missionHours);
+    lastChange = now;
+  }
+}
+
+void processPower()
+{
+  static time_t lastTimeActive = 0; // only really do this once per second
+  time_t now = getMissionTime();
+  if (now == lastTimeActive)
+    return;
+  time_t elapsed = lastTimeActive == 0 ? 1 : now - lastTimeActive;
+  lastTimeActive = now;
+
+  float ma[PowerInfo::LOAD_COUNT];
+  const IridiumInfo &iinf = getIridiumInfo();
+  ma[PowerInfo::LOAD_CPU] = CPU_MA;
+  ma[PowerInfo::LOAD_GPS] = gpsIsOn() ? GPS_MA : 0.0f;
+  ma[PowerInfo::LOAD_MODEM] = iinf.isTransmitting ? MODEM_TX_MA : iinf.isAwake ? MODEM_IDLE_MA : 0.0f;
+  ma[PowerInfo::LOAD_DISPLAY] = displayIsOn() ? DISPLAY_ON_MA : 0.0f;
+  ma[PowerInfo::LOAD_CAMERA] = cameraIsOn() ? CAMERA_MA : 0.0f;
+
+  info.loadMa = 0.0;
+  for (int i=0; i<PowerInfo::LOAD_COUNT; ++i)
+  {
+    info.loadMa += ma[i];
+    info.consumedMah[i] += ma[i] * elapsed / 3600.0f;
+  }
+  // 1 - e^-kt rather than kt, so a long gap (deep sleep, a modem session) can't overshoot
+  info.averageLoadMa += (1.0f - expf(-LOAD_SMOOTHING * elapsed)) * (info.loadMa - info.averageLoadMa);
+  setBatteryLoad(info.averageLoadMa);
+  govern();
+}
+
+// True if the governor has reached (or passed) the given throttle level
+bool powerThrottled(int level)
+{
+  return info.level >= level;
+}
+
+void showPower()
+{
+  log("Power level: %s\r\n", levelNames[info.level]);
+  log("Load now %.1f mA, average %.1f mA\r\n", info.loadMa, info.averageLoadMa);
+  for (int i=0; i<PowerInfo::LOAD_COUNT; ++i)
+    log("  %-8s %8.1f mAh\r\n", loadNames[i], info.consumedMah[i]);
+  showSleepStats();
+}
+
+const PowerInfo &getPowerInfo()
+{
+  return info;
+}
@@ -0,0 +1,113 @@
+#include <Arduino.h>
+#include "BalloonRide.h"
+
+/*
+ * Cycle-count profiler for the main loop
+ *
+ * The Cortex-M4's DWT cycle counter ticks once per CPU clock.  loop() calls
+ * profileStart() at the top of each pass and profileMark() after each
+ * subsystem, which charges the cycles since the previous mark to that
+ * subsystem.  Time spent asleep is never charged.  Passes made from inside
+ * the Iridium callback are charged to Iridium, since that's who is
+ * holding the loop up.  The PROFILE console command shows the average and
+ * worst case per pass.
+ *
+ * Each mark also tells the black box which section runs next, and a
+ * section that holds the loop for more than SLOW_MS goes into its trace.
+ * Each pass also checks its stack depth on the way in and on the way out
+ * (see Memory.cpp).
+ */
+
+static const char *sectionNames[PROFILE_COUNT] =
+  {"GPS", "thermal", "battery", "power", "logs", "Iridium", "LED", "display", "console", "scheduler", "outputs", "recorder"};
+static uint64_t totalCycles[PROFILE_COUNT];
+static uint32_t worstCycles[PROFILE_COUNT];
+static uint32_t passes = 0;
+static uint32_t lastMark = 0;
+static unsigned long lastMarkMs = 0;
+static int depth = 0;
+static const unsigned long SLOW_MS = 2000; // the GPS read alone can take a second
+
+void startProfiler()
+{
+  ARM_DEMCR |= ARM_DEMCR_TRCENA;
+  ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+  resetProfile();
+}
+
+void profileStart()
+{
+  traceWhere(0, depth > 0);
+  stackEntry(depth > 0 ? STACK_NESTED : STACK_LOOP);
+  if (depth++ > 0)
+    return;
+  lastMark = ARM_DWT_CYCCNT;
+  lastMarkMs = millis();
+  ++passes;
+}
+
+void profileMark(int section)
+{
+  traceWhere(section + 1 < PROFILE_COUNT ? section + 1 : -1, depth > 1);
+  if (depth != 1)
+    return;
+  uint32_t now = ARM_DWT_CYCCNT;
+  uint32_t cycles = now - lastMark;
+  totalCycles[section] += cycles;
+  if (cycles > worstCycles[section])
+    worstCycles[section] = cycles;
+  lastMark = now;
+
+  unsigned long ms = millis() - lastMarkMs;
+  if (ms > SLOW_MS)
+    trace(TRACE_SLOW, section, ms);
+  lastMarkMs += ms;
+}
+
+void profileEnd()
+{
+  --depth;
+  traceWhere(-1, depth > 0);
+  stackCheck(depth > 0 ? STACK_NESTED : STACK_LOOP);
+}
+
+void resetProfile()
+{
+  memset(totalCycles, 0, sizeof totalCycles);
+  memset(worstCycles, 0, sizeof worstCycles);
+  passes = 0;
+}
+
+uint32_t profilePasses()
+{
+  return passes;
+}
+
+uint32_t profileAverage(int section)
+{
+  return passes > 0 ? totalCycles[section] / passes : 0;
+}
+
+uint32_t profileWorst(int section)
+{
+  return worstCycles[section];
+}
+
+const char *profileSectionName(int section)
+{
+  return sectionNames[section];
+}
+
+void showProfile()
+{
+  uint32_t n = passes > 0 ? passes : 1;
+  uint64_t sum = 0;
+  log("Profile over %lu passes (cycles at %lu MHz):\r\n", (unsigned long)passes, F_CPU / 1000000UL);
+  log("  %-10s %10s %10s\r\n", "", "average", "worst");
+  for (int i=0; i<PROFILE_COUNT; ++i)
+  {
+    log("  %-10s %10lu %10lu\r\n", sectionNames[i], (unsigned long)(totalCycles[i] / n), (unsigned long)worstCycles[i]);
+    sum += totalCycles[i];
+  }
+  log("  %-10s %10lu (%lu us)\r\n", "per pass", (unsigned long)(sum / n), (unsigned long)(sum / n / (F_CPU / 1000000UL)));
+}
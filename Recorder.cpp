@@ -0,0 +1,204 @@
+#include <Arduino.h>
+#include <SdFat.h>
+#include "BalloonRide.h"
+
+/*
+ * High-rate flight recorder
+ *
+ * The telemetry log is 1 Hz at best, a record a minute in NORWAY mode.
+ * That barely resolves the few seconds that matter most: burst, cut-down
+ * and touchdown.  So every GPS fix also goes into a ring in RAM, along
+ * with vertical speed, the temperatures and the battery.  In flight the
+ * GPS is asked for 2 fixes a second while it's on full time.
+ *
+ * A trigger freezes the ring around the moment it fired: PRE_SAMPLES
+ * before and POST_SAMPLES after.  That window goes to SD in one bulk write,
+ * as a small header plus the raw samples (tools/recorder.py makes CSV of
+ * them).  The triggers are:
+ * - a cut-down (BurstStart);
+ * - a fall faster than RAPID_DESCENT: "burst" near the highest altitude
+ *   seen, "descent" anywhere else;
+ * - the landing, when the vertical speed has stayed near zero for STILL_MS
+ *   after a descent, or when the flight-state logic says LANDED.
+ * Each fires once per flight.  RECORDER now forces a capture.
+ */
+
+struct Sample
+{
+  uint32_t ms;
+  int32_t latitude, longitude; // 1e-7 degrees
+  int32_t altitude;            // meters
+  int16_t verticalSpeed;       // cm/s, smoothed
+  int16_t temperature[2];      // centi-degrees C, internal and external
+  uint16_t batteryMv;
+  uint16_t speed;              // cm/s over the ground
+  uint8_t satellites;
+  uint8_t flags;
+};
+enum { SAMPLE_FIX = 1, SAMPLE_STALE = 2, SAMPLE_FLYING = 4 };
+
+// What tools/recorder.py reads ahead of the samples
+struct CaptureHeader
+{
+  char magic[4];
+  uint16_t sampleSize;
+  uint16_t samples;
+  uint16_t triggerSample;      // first sample after the trigger
+  uint8_t trigger;
+  uint8_t reserved;
+  uint32_t triggerMs;
+};
+
+static const int PRE_SAMPLES = 240;              // 2 minutes at 2 Hz
+static const int POST_SAMPLES = 240;
+static const int RING_SAMPLES = PRE_SAMPLES + POST_SAMPLES;
+static const unsigned long POST_TIMEOUT_MS = 4 * 60000UL; // write what we have if the fixes stop
+static const float RAPID_DESCENT = 5.0;          // m/s
+static const int DESCENT_SAMPLES = 4;            // in a row, so one bad fix can't trigger
+static const long BURST_BAND = 1000;             // m below the highest altitude
+static const float STILL_SPEED = 1.0;            // m/s
+static const unsigned long STILL_MS = 20000UL;
+static const int16_t INVALID_CENTIDEGREES = -32768;
+
+static const char *triggerNames[TRIGGER_COUNT] = {"manual", "cutdown", "burst", "descent", "landing"};
+static Sample ring[RING_SAMPLES];
+static int head = 0, count = 0;
+static struct
+{
+  bool capturing;
+  uint8_t trigger;
+  int triggerCount;           // samples in the ring when it fired
+  int after;                  // samples since
+  unsigned long triggerMs;
+} capture;
+static bool fired[TRIGGER_COUNT];
+static int captures = 0;
+
+static unsigned long lastFix = 0;
+static long highest = INVALID_ALTITUDE;
+static int fallingSamples = 0;
+static unsigned long stillSince = 0;
+static bool descending = false;
+
+static int16_t centidegrees(float celsius)
+{
+  return celsius == INVALID_TEMPERATURE ? INVALID_CENTIDEGREES : (int16_t)constrain(celsius * 100.0f, -32767.0f, 32767.0f);
+}
+
+void recorderTrigger(int trigger)
+{
+  if (fired[trigger] && trigger != TRIGGER_MANUAL)
+    return;
+  fired[trigger] = true;
+  if (trigger == TRIGGER_CUTDOWN || trigger == TRIGGER_BURST || trigger == TRIGGER_DESCENT)
+    descending = true;
+  trace(TRACE_CAPTURE, trigger, count);
+  if (capture.capturing)
+  {
+    log(F("Recorder: %s trigger falls inside the %s capture\r\n"), triggerNames[trigger], triggerNames[capture.trigger]);
+    return;
+  }
+  log(F("Recorder: %s trigger, %d samples before it\r\n"), triggerNames[trigger], min(count, PRE_SAMPLES));
+  capture.capturing = true;
+  capture.trigger = trigger;
+  capture.triggerCount = count;
+  capture.after = 0;
+  capture.triggerMs = millis();
+}
+
+// The frozen window, oldest first, in at most two pieces of the ring
+static void writeCapture()
+{
+  int before = min(capture.triggerCount, PRE_SAMPLES);
+  int total = before + capture.after;
+  int first = (head - total + RING_SAMPLES) % RING_SAMPLES;
+  int firstPart = min(total, RING_SAMPLES - first);
+  capture.capturing = false;
+  ++captures;
+
+  char name[20];
+  snprintf(name, sizeof name, "%s%d.rec", triggerNames[capture.trigger], captures);
+  File file;
+  if (SDFail() || !file.open(name, O_CREAT | O_TRUNC | O_WRITE))
+  {
+    log(F("Recorder: couldn't create %s\r\n"), name);
+    return;
+  }
+  CaptureHeader header = {{'B', 'R', 'F', 'R'}, sizeof(Sample), (uint16_t)total, (uint16_t)before,
+    capture.trigger, 0, (uint32_t)capture.triggerMs};
+  unsigned long start = millis();
+  bool ok = file.write(&header, sizeof header) == sizeof header &&
+    file.write(&ring[first], firstPart * sizeof(Sample)) == (int)(firstPart * sizeof(Sample)) &&
+    file.write(&ring[0], (total - firstPart) * sizeof(Sample)) == (int)((total - firstPart) * sizeof(Sample));
+  ok = file.close() && ok;
+  log(F("Recorder: %s %s, %d samples in %lu ms\r\n"), name, ok ? "written" : "WRITE FAILED", total, millis() - start);
+}
+
+// The burst, descent and landing triggers
+static void watchFlight(const GPSInfo &ginf, unsigned long now, bool flying)
+{
+  if (highest == INVALID_ALTITUDE || ginf.altitude > highest)
+    highest = ginf.altitude;
+
+  fallingSamples = ginf.verticalSpeed < -RAPID_DESCENT ? fallingSamples + 1 : 0;
+  if (flying && !descending && fallingSamples >= DESCENT_SAMPLES)
+    recorderTrigger(highest - ginf.altitude < BURST_BAND ? TRIGGER_BURST : TRIGGER_DESCENT);
+
+  if (fabsf(ginf.verticalSpeed) >= STILL_SPEED)
+    stillSince = now;
+  else if (descending && now - stillSince >= STILL_MS)
+    recorderTrigger(TRIGGER_LANDING);
+}
+
+void processRecorder()
+{
+  const GPSInfo &ginf = getGPSInfo();
+  int flightState = getBalloonInfo().flightState;
+  bool flying = flightState == BalloonInfo::INFLIGHT;
+  setGPSFastFixes(flying && getModeProfile().gpsOffSeconds == 0 && !powerThrottled(PowerInfo::GPS_DUTY_CYCLE));
+  if (flightState == BalloonInfo::LANDED)
+    recorderTrigger(TRIGGER_LANDING); // in case the touchdown was too gentle to see
+
+  if (ginf.fixCount != lastFix && ginf.fixAcquired)
+  {
+    lastFix = ginf.fixCount;
+    unsigned long now = millis();
+    watchFlight(ginf, now, flying);
+
+    const ThermalInfo &tinf = getThermalInfo();
+    float volts = getBatteryInfo().batteryVoltage;
+    Sample &s = ring[head];
+    s.ms = now;
+    s.latitude = ginf.latitude;
+    s.longitude = ginf.longitude;
+    s.altitude = ginf.altitude;
+    s.verticalSpeed = (int16_t)constrain(ginf.verticalSpeed * 100.0f, -32767.0f, 32767.0f);
+    s.temperature[0] = centidegrees(tinf.temperature[0]);
+    s.temperature[1] = centidegrees(tinf.temperature[1]);
+    s.batteryMv = volts == INVALID_VOLTAGE ? 0 : (uint16_t)(volts * 1000.0f);
+    s.speed = (uint16_t)constrain(ginf.speed * 51.444f, 0.0f, 65535.0f); // knots
+    s.satellites = ginf.satellites;
+    s.flags = SAMPLE_FIX | (ginf.staleFix ? SAMPLE_STALE : 0) | (flying ? SAMPLE_FLYING : 0);
+    head = (head + 1) % RING_SAMPLES;
+    if (count < RING_SAMPLES)
+      ++count;
+    if (capture.capturing)
+      ++capture.after;
+  }
+
+  if (capture.capturing && (capture.after >= POST_SAMPLES || millis() - capture.triggerMs >= POST_TIMEOUT_MS))
+    writeCapture();
+}
+
+void showRecorder()
+{
+  log(F("Recorder: %d of %d samples (%u bytes), vertical speed %.1f m/s, highest %ld m\r\n"),
+    count, RING_SAMPLES, (unsigned)sizeof ring, getGPSInfo().verticalSpeed, highest);
+  if (capture.capturing)
+    log(F("  capturing after %s trigger: %d of %d samples\r\n"), triggerNames[capture.trigger], capture.after, POST_SAMPLES);
+  log(F("  fired:"));
+  for (int i=0; i<TRIGGER_COUNT; ++i)
+    if (fired[i])
+      log(" %s", triggerNames[i]);
+  log(F("\r\n  %d captures written\r\n"), captures);
+}
@@ -3,23 +3,66 @@
 #include <Snooze.h>
 /*
  * Rationale:
- * 
+ *
  * There are three modes: NORMAL, ALERT, and NORWAY.
- * 
+ *
  * NORMAL is normal
  * ALERT is NORMAL plus listen for RINGs (be responsive to commands)
  * NORWAY is ultra-conserving: wake only occasionally
+ *
+ * Left to itself (AUTO), the mode follows the flight: ALERT on the ground
+ * and after landing, when people are around to send commands; NORMAL in
+ * flight; NORWAY whenever the battery is nearly flat or the power governor
+ * has run out of other loads to shed.  The 'O' remote command can pin a
+ * mode.  Each mode's profile sets the GPS duty cycle, whether the modem
+ * stays awake to hear RING, how often primaries and telemetry records go
+ * out, whether the display may light, and how long the CPU may sleep.
+ *
+ * Between loop passes we idle until the earliest deadline of any subsystem.
+ * Nearly everything runs on the one-second mission tick; the thermal probes
+ * may want us sooner.  While the GPS is streaming we can only wait for an
+ * interrupt (a deep sleep would stop the UART and cost us NMEA sentences),
+ * but while it is off we drop into Snooze deep sleep, waking on the timer,
+ * a RING from the modem, or a character on the console.
  */
 
-enum {NORMAL, ALERT, NORWAY};
-static int mode = NORMAL;
-static unsigned long DEFSLEEP = 3000;
+static const ModeProfile profiles[] =
+{
+  // name      GPS off  RING   min primary  log  display  sleep tick
+  {"NORMAL",        0, false,            0,   1,   true,   1},
+  {"ALERT",         0,  true,            0,   1,   true,   1},
+  {"NORWAY",  15 * 60, false,           60,  60,  false,  10},
+};
+static int mode = ModeProfile::NORMAL;
+static int requestedMode = ModeProfile::AUTO;
+static const float NORWAY_ENTER_SOC = 15.0; // percent
+static const float NORWAY_LEAVE_SOC = 25.0;
 static time_t systemStartTime = 0;
+static const unsigned long MIN_SLEEP = 5UL; // ms; not worth sleeping for less
 
 // Load drivers
-SnoozeCompare compare;
+SnoozeDigital digital;
 SnoozeTimer timer;
-SnoozeBlock config(timer/*, compare*/);
+SnoozeBlock config(timer, digital);
+
+// Residency statistics
+static uint64_t awakeMs = 0, idleMs = 0, deepMs = 0; // 32 bits of ms run out in 49 days
+static unsigned long wakeCount[4]; // timer, RING, console, GPS/other
+enum {WAKE_TIMER, WAKE_RING, WAKE_CONSOLE, WAKE_OTHER};
+static const char *wakeNames[] = {"timer", "RING", "console", "GPS/other"};
+
+// The RTC in ms: seconds from RTC_TSR, the fraction from its 32768 Hz
+// prescaler.  Only differences mean anything, and they survive the wrap.
+static unsigned long rtcMillis()
+{
+  uint32_t seconds, prescaler;
+  do
+  {
+    seconds = RTC_TSR;
+    prescaler = RTC_TPR;
+  } while (seconds != RTC_TSR); // the prescaler rolled over in between
+  return seconds * 1000UL + (((prescaler & 0x7FFF) * 1000UL) >> 15);
+}
 
 void startClocks()
 {
@@ -30,32 +73,154 @@ void startClocks()
 
 void startSleep()
 {
-  consoleText("In startSleep\r\n");
-  timer.setTimer(DEFSLEEP);
-  compare.pinMode(11, LOW, 1.65);//pin, type, threshold(v)
+  log(F("Starting sleep manager\r\n"));
+  if (rockBLOCKRingPin != -1)
+    digital.pinMode(rockBLOCKRingPin, INPUT_PULLUP, FALLING); // RING is active low
+  if (consoleRxPin != -1)
+    digital.pinMode(consoleRxPin, INPUT_PULLUP, FALLING);     // start bit
+}
+
+// How many ms until some subsystem next needs the CPU
+static unsigned long nextDeadline()
+{
+  static time_t lastSecond = 0;
+  static unsigned long secondStart = 0;
+
+  // Track where we are within the mission second, and sleep to the next tick
+  time_t now = getMissionTime();
+  if (now != lastSecond)
+  {
+    lastSecond = now;
+    secondStart = millis();
+  }
+  time_t tick = profiles[mode].sleepTick;
+  unsigned long untilTick = 1000UL * (tick - now % tick);
+  unsigned long sinceTick = millis() - secondStart;
+  unsigned long deadline = sinceTick >= untilTick ? 0UL : untilTick - sinceTick;
+
+  unsigned long thermal = thermalDeadline();
+  if (thermal < deadline)
+    deadline = thermal;
+  unsigned long outputs = outputsDeadline();
+  if (outputs < deadline)
+    deadline = outputs;
+  return deadline;
+}
+
+static void setMode(int newMode, const char *reason)
+{
+  if (newMode == mode)
+    return;
+  log(F("Mode %s -> %s (%s)\r\n"), profiles[mode].name, profiles[newMode].name, reason);
+  trace(TRACE_MODE, newMode);
+  mode = newMode;
+}
+
+// Called once per second: pick the mode that fits the battery and the flight
+static void updateMode()
+{
+  static time_t lastTimeActive = 0;
+  time_t now = getMissionTime();
+  if (now == lastTimeActive)
+    return;
+  lastTimeActive = now;
+
+  if (requestedMode != ModeProfile::AUTO)
+  {
+    setMode(requestedMode, "commanded");
+    return;
+  }
+
+  float soc = getBatteryInfo().stateOfCharge;
+  bool exhausted = powerThrottled(PowerInfo::GPS_DUTY_CYCLE);
+  if (soc >= 0 && soc < NORWAY_ENTER_SOC)
+    setMode(ModeProfile::NORWAY, "battery low");
+  else if (exhausted)
+    setMode(ModeProfile::NORWAY, "power budget");
+  else if (mode == ModeProfile::NORWAY && soc >= 0 && soc < NORWAY_LEAVE_SOC)
+    ; // stay put until the battery has recovered a little
+  else if (getBalloonInfo().flightState == BalloonInfo::INFLIGHT)
+    setMode(ModeProfile::NORMAL, "in flight");
+  else
+    setMode(ModeProfile::ALERT, getBalloonInfo().flightState == BalloonInfo::LANDED ? "landed" : "on ground");
+}
+
+// Pin a mode (or ModeProfile::AUTO to let the controller choose); false if there's no such mode
+bool setPowerMode(int newMode)
+{
+  if (newMode < ModeProfile::NORMAL || newMode > ModeProfile::AUTO)
+    return false;
+  requestedMode = newMode;
+  log(F("Mode request: %s\r\n"), newMode == ModeProfile::AUTO ? "AUTO" : profiles[newMode].name);
+  return true;
+}
+
+int getPowerMode()
+{
+  return mode;
+}
+
+const ModeProfile &getModeProfile()
+{
+  return profiles[mode];
 }
 
 void processSleep()
 {
-  consoleText("In processSleep\r\n");
-  delay(100);
-  if (!getIridiumInfo().isTransmitting)
+  updateMode();
+
+  static unsigned long lastWake = 0;
+  unsigned long start = millis();
+  awakeMs += start - lastWake;
+
+  unsigned long deadline = nextDeadline();
+  if (getIridiumInfo().isTransmitting || displayBusy() || consoleBusy() || !startupComplete() || deadline < MIN_SLEEP)
+  {
+    lastWake = start;
+    return;
+  }
+
+  if (gpsIsOn())
+  {
+    // Light sleep: wait for interrupts until the deadline or until something arrives
+    while (millis() - start < deadline && !GPSSerial.available() && !ConsoleSerial.available())
+      asm volatile("wfi");
+    idleMs += millis() - start;
+    if (ConsoleSerial.available())
+      wakeCount[WAKE_CONSOLE]++;
+    else if (millis() - start >= deadline)
+      wakeCount[WAKE_TIMER]++;
+    else
+      wakeCount[WAKE_OTHER]++;
+  }
+  else
   {
-    digitalWrite(ledPin, LOW);
-    consoleText("About to sleep\r\n");
-    delay(200);
-    gpsOff();
-    int who = Snooze.sleep(config);
-    gpsOn();
-    consoleText("Sleep 'who' is ");
-    consoleText(who);
-    consoleText("\r\n");
-    digitalWrite(ledPin, HIGH);
+    // Deep sleep: the clocks stop, so millis() must be wound forward by hand
+    unsigned long before = rtcMillis();
+    timer.setTimer(deadline);
+    int who = Snooze.deepSleep(config);
+    unsigned long slept = who == 36 ? deadline : rtcMillis() - before; // 36 is the LPTMR
+    systick_millis_count += slept;
+    deepMs += slept;
+    wakeCount[who == 36 ? WAKE_TIMER : who == rockBLOCKRingPin ? WAKE_RING : who == consoleRxPin ? WAKE_CONSOLE : WAKE_OTHER]++;
   }
+  lastWake = millis();
+}
+
+void showSleepStats()
+{
+  uint64_t total = awakeMs + idleMs + deepMs;
+  if (total == 0)
+    total = 1;
+  log("Residency: awake %lu%%, idle %lu%%, deep sleep %lu%%\r\n",
+    (unsigned long)(100 * awakeMs / total), (unsigned long)(100 * idleMs / total), (unsigned long)(100 * deepMs / total));
+  log("Wakes:");
+  for (int i=0; i<4; ++i)
+    log(" %s=%lu", wakeNames[i], wakeCount[i]);
+  log("\r\n");
 }
 
 time_t getMissionTime()
 {
   return Teensy3Clock.get() - systemStartTime;
-}
-
+}
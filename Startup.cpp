@@ -0,0 +1,84 @@
+#include <Arduino.h>
+#include "BalloonRide.h"
+
+/*
+ * Startup bookkeeping
+ *
+ * setup() only kicks each subsystem off.  The slow parts finish from the
+ * main loop: the display splash, GPS detection, and the modem's first AT
+ * handshake (during which ISBDCallback keeps the loop turning).  So logging
+ * and telemetry start straight away, and late subsystems join when they're
+ * ready.  Each subsystem reports here when it starts and when it is up (or
+ * has failed).  Once all have reported, the boot-time breakdown goes to the
+ * run log.  STARTUP shows it again.
+ */
+
+static const char *stageNames[STARTUP_COUNT] =
+  {"setup", "display", "logs", "thermal", "battery", "GPS", "Iridium", "outputs", "telemetry"};
+enum { PENDING, STARTING, READY, FAILED };
+static struct
+{
+  uint8_t state;
+  unsigned long started, finished; // ms since reset
+} stages[STARTUP_COUNT];
+static bool reported = false;
+
+void startupBegin(int which)
+{
+  stages[which].state = STARTING;
+  stages[which].started = millis();
+}
+
+void startupDone(int which, bool ok)
+{
+  if (stages[which].state != STARTING)
+    return;
+  stages[which].state = ok ? READY : FAILED;
+  stages[which].finished = millis();
+  log(F("Startup: %s %s after %lu ms\r\n"), stageNames[which], ok ? "ready" : "FAILED",
+    stages[which].finished - stages[which].started);
+
+  if (!reported && startupComplete())
+  {
+    reported = true;
+    showStartup();
+    showMemory();
+  }
+}
+
+bool subsystemReady(int which)
+{
+  return stages[which].state == READY;
+}
+
+// Everybody has reported in, one way or the other
+bool startupComplete()
+{
+  for (int i=0; i<STARTUP_COUNT; ++i)
+    if (stages[i].state == PENDING || stages[i].state == STARTING)
+      return false;
+  return true;
+}
+
+void showStartup()
+{
+  unsigned long last = 0;
+  log(F("Boot time (ms since reset):\r\n"));
+  log("  %-10s %7s %7s %7s\r\n", "", "start", "ready", "took");
+  for (int i=0; i<STARTUP_COUNT; ++i)
+  {
+    if (stages[i].state == PENDING)
+      log("  %-10s %7s\r\n", stageNames[i], "-");
+    else if (stages[i].state == STARTING)
+      log("  %-10s %7lu %7s %7lu so far\r\n", stageNames[i], stages[i].started, "-", millis() - stages[i].started);
+    else
+    {
+      log("  %-10s %7lu %7lu %7lu%s\r\n", stageNames[i], stages[i].started, stages[i].finished,
+        stages[i].finished - stages[i].started, stages[i].state == FAILED ? " FAILED" : "");
+      if (stages[i].finished > last)
+        last = stages[i].finished;
+    }
+  }
+  if (startupComplete())
+    log(F("  all up after %lu ms\r\n"), last);
+}
@@ -0,0 +1,125 @@
+#include <Arduino.h>
+#include "BalloonRide.h"
+
+/*
+ * Per-interval statistics
+ *
+ * A secondary message or a NORWAY-mode log record covers minutes, and one
+ * reading taken as it goes out says little about them.  So each new
+ * telemetry snapshot is also added to a running summary of every sensor:
+ * count, min, max, mean and variance, updated in place (Welford's method),
+ * in a few words per sensor however long the interval.  There is one set
+ * of summaries per consumer, which resets it once its interval has been
+ * reported: the telemetry log on each record, the secondary message as it
+ * goes out.  A transmission takes a while and the loop keeps running
+ * meanwhile, so the secondary takes a copy and resets at once; if the
+ * transmission fails, the copy is merged back (Chan's parallel form of
+ * Welford) and the next attempt covers both.
+ *
+ * Course is summed as a velocity vector, which gets the average right
+ * across north and weights a crawl at a few knots, mostly GPS jitter,
+ * lightly.
+ */
+
+static const float DEGREES_TO_RADIANS = 0.01745329252f;
+static const float RADIANS_TO_DEGREES = 57.29577951f;
+static IntervalStats intervals[INTERVAL_COUNT];
+
+void Statistic::add(float x)
+{
+  if (count == 0)
+  {
+    min = max = x;
+    mean = m2 = 0.0f;
+  }
+  ++count;
+  if (x < min)
+    min = x;
+  if (x > max)
+    max = x;
+  float delta = x - mean;
+  mean += delta / count;
+  m2 += delta * (x - mean);
+}
+
+// As if every value behind other had been add()ed here
+void Statistic::merge(const Statistic &other)
+{
+  if (other.count == 0)
+    return;
+  if (count == 0)
+  {
+    *this = other;
+    return;
+  }
+  unsigned long n = count + other.count;
+  float delta = other.mean - mean;
+  float weight = (float)other.count / n;
+  mean += delta * weight;
+  m2 += other.m2 + delta * delta * count * weight;
+  if (other.min < min)
+    min = other.min;
+  if (other.max > max)
+    max = other.max;
+  count = n;
+}
+
+void processStatistics()
+{
+  static uint32_t lastSequence = 0;
+  const Telemetry &t = getTelemetry();
+  if (t.sequence == lastSequence)
+    return;
+  lastSequence = t.sequence;
+
+  for (int i=0; i<INTERVAL_COUNT; ++i)
+  {
+    IntervalStats &s = intervals[i];
+    ++s.samples;
+    for (int j=0; j<2; ++j)
+      if (j < t.thermal.probeCount && t.thermal.temperature[j] != INVALID_TEMPERATURE)
+        s.temperature[j].add(t.thermal.temperature[j]);
+    if (t.battery.batteryVoltage != INVALID_VOLTAGE)
+      s.battery.add(t.battery.batteryVoltage);
+    if (t.gps.fixAcquired && !t.gps.staleFix)
+    {
+      s.altitude.add(t.gps.altitude);
+      s.speed.add(t.gps.speed);
+      s.satellites.add(t.gps.satellites);
+      s.courseX += t.gps.speed * sinf(t.gps.course * DEGREES_TO_RADIANS);
+      s.courseY += t.gps.speed * cosf(t.gps.course * DEGREES_TO_RADIANS);
+    }
+  }
+}
+
+const IntervalStats &getIntervalStats(int which)
+{
+  return intervals[which];
+}
+
+// Degrees, 0 to 360
+float meanCourse(const IntervalStats &s)
+{
+  float course = atan2f(s.courseX, s.courseY) * RADIANS_TO_DEGREES;
+  return course < 0 ? course + 360.0f : course;
+}
+
+void resetIntervalStats(int which)
+{
+  memset(&intervals[which], 0, sizeof intervals[which]);
+}
+
+// Put back an interval taken out by an unsuccessful report
+void mergeIntervalStats(int which, const IntervalStats &earlier)
+{
+  IntervalStats &s = intervals[which];
+  s.samples += earlier.samples;
+  for (int j=0; j<2; ++j)
+    s.temperature[j].merge(earlier.temperature[j]);
+  s.battery.merge(earlier.battery);
+  s.altitude.merge(earlier.altitude);
+  s.speed.merge(earlier.speed);
+  s.satellites.merge(earlier.satellites);
+  s.courseX += earlier.courseX;
+  s.courseY += earlier.courseY;
+}
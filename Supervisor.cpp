@@ -0,0 +1,188 @@
+#include <Arduino.h>
+#include "BalloonRide.h"
+
+/*
+ * Subsystem supervisor and hardware watchdog
+ *
+ * A peripheral that stops answering mid-flight mustn't take the rest of the
+ * flight down with it.  Subsystems report their faults here instead of
+ * calling fatal().  The owner keeps running without the peripheral and asks
+ * restartDue() when to try bringing it back.  Retries back off from the
+ * policy's first interval, doubling up to its longest, until one works.
+ *
+ * The Kinetis watchdog resets the CPU if it goes WATCHDOG_MS without a
+ * refresh.  processSupervisor() refreshes it only while every critical task
+ * has checked in recently, so a wedged task gets a reset even when the loop
+ * around it is still turning.  The watchdog doesn't count in stop mode, so
+ * deep sleep is safe.  fatal() no longer halts for good, because the
+ * watchdog restarts us instead.
+ */
+
+static const unsigned long WATCHDOG_MS = 30000UL;
+static const unsigned long FEED_INTERVAL = 1000UL; // WDOG register writes are slow: don't do it every pass
+
+static const struct
+{
+  const char *name;
+  bool critical;              // the watchdog is fed only while this checks in...
+  unsigned long stallMs;      // ... at least this often
+  unsigned long firstRetryMs; // restart backoff
+  unsigned long longestRetryMs;
+} policies[SUPERVISE_COUNT] =
+{
+  {"GPS",     true,   30000UL,  30000UL, 15 * 60000UL},
+  {"logs",    true,  150000UL,        0,            0}, // NORWAY logs once a minute
+  {"Iridium", false,        0,  60000UL, 30 * 60000UL},
+};
+static const char *healthNames[] = {"starting", "OK", "degraded", "DOWN"};
+
+static struct
+{
+  uint8_t health;
+  unsigned long lastCheckIn;
+  unsigned long retryAt, backoff;
+  uint16_t faults, restarts;
+} tasks[SUPERVISE_COUNT];
+static bool watchdogRunning = false;
+static bool watchdogStarving = false;
+
+void startSupervisor()
+{
+  if (RCM_SRS0 & RCM_SRS0_WDOG)
+    log(F("Restarted by the watchdog (%u times since power-on)\r\n"), (unsigned)WDOG_RSTCNT);
+  for (int i=0; i<SUPERVISE_COUNT; ++i)
+  {
+    tasks[i].lastCheckIn = millis();
+    tasks[i].backoff = policies[i].firstRetryMs;
+  }
+
+  // 1 kHz LPO clock, so the timeout is in ms; keep counting in wait mode (light sleep)
+  __disable_irq();
+  WDOG_UNLOCK = WDOG_UNLOCK_SEQ1;
+  WDOG_UNLOCK = WDOG_UNLOCK_SEQ2;
+  __asm__ volatile ("nop");
+  __asm__ volatile ("nop");
+  WDOG_TOVALH = WATCHDOG_MS >> 16;
+  WDOG_TOVALL = WATCHDOG_MS & 0xFFFF;
+  WDOG_PRESC = 0;
+  WDOG_STCTRLH = WDOG_STCTRLH_ALLOWUPDATE | WDOG_STCTRLH_WDOGEN | WDOG_STCTRLH_WAITEN | WDOG_STCTRLH_IRQRSTEN;
+  __enable_irq();
+
+  // The interrupt just ahead of the reset lets the black box see where we were stuck
+  NVIC_SET_PRIORITY(IRQ_WDOG, 0);
+  NVIC_ENABLE_IRQ(IRQ_WDOG);
+  watchdogRunning = true;
+  log(F("Watchdog armed: %lu s\r\n"), WATCHDOG_MS / 1000);
+}
+
+void feedWatchdog()
+{
+  if (!watchdogRunning)
+    return;
+  __disable_irq();
+  WDOG_REFRESH = 0xA602;
+  WDOG_REFRESH = 0xB480;
+  __enable_irq();
+}
+
+// A critical task has made progress
+void supervisorCheckIn(int which)
+{
+  tasks[which].lastCheckIn = millis();
+}
+
+void reportHealthy(int which)
+{
+  if (tasks[which].health == HEALTH_DOWN || tasks[which].health == HEALTH_DEGRADED)
+  {
+    log(F("%s recovered after %u faults, %u restarts\r\n"), policies[which].name, tasks[which].faults, tasks[which].restarts);
+    trace(TRACE_RECOVERED, which, tasks[which].faults);
+  }
+  tasks[which].health = HEALTH_OK;
+  tasks[which].backoff = policies[which].firstRetryMs;
+}
+
+// Still working, but not well
+void reportDegraded(int which, const char *why)
+{
+  ++tasks[which].faults;
+  if (tasks[which].health == HEALTH_OK)
+  {
+    log(F("%s degraded: %s\r\n"), policies[which].name, why);
+    tasks[which].health = HEALTH_DEGRADED;
+  }
+}
+
+// Not working: the owner carries on without it until restartDue() says otherwise
+void reportFault(int which, const char *why)
+{
+  unsigned long now = millis();
+  ++tasks[which].faults;
+  tasks[which].health = HEALTH_DOWN;
+  tasks[which].retryAt = now + tasks[which].backoff;
+  trace(TRACE_FAULT, which, tasks[which].faults);
+  log(F("%s down: %s; retrying in %lu s\r\n"), policies[which].name, why, tasks[which].backoff / 1000);
+  tasks[which].backoff = min(2 * tasks[which].backoff, policies[which].longestRetryMs);
+}
+
+bool restartDue(int which)
+{
+  if (tasks[which].health != HEALTH_DOWN || (long)(millis() - tasks[which].retryAt) < 0)
+    return false;
+  ++tasks[which].restarts;
+  tasks[which].retryAt = millis() + tasks[which].backoff; // in case the attempt never reports back
+  log(F("Restarting %s (attempt %u)\r\n"), policies[which].name, tasks[which].restarts);
+  trace(TRACE_RESTART, which, tasks[which].restarts);
+  return true;
+}
+
+int getHealth(int which)
+{
+  return tasks[which].health;
+}
+
+const char *supervisedName(int which)
+{
+  return which < SUPERVISE_COUNT ? policies[which].name : "?";
+}
+
+void processSupervisor()
+{
+  static unsigned long lastFeed = 0;
+  unsigned long now = millis();
+
+  int stalled = -1;
+  for (int i=0; i<SUPERVISE_COUNT; ++i)
+    if (policies[i].critical && now - tasks[i].lastCheckIn > policies[i].stallMs)
+      stalled = i;
+
+  if (stalled != -1)
+  {
+    if (!watchdogStarving)
+      log(F("%s has stalled: letting the watchdog reset us\r\n"), policies[stalled].name);
+    watchdogStarving = true;
+    return;
+  }
+  watchdogStarving = false;
+  if (now - lastFeed >= FEED_INTERVAL)
+  {
+    lastFeed = now;
+    feedWatchdog();
+  }
+}
+
+void showSupervisor()
+{
+  unsigned long now = millis();
+  log("  %-8s %-9s %6s %8s %10s\r\n", "", "health", "faults", "restarts", "last seen");
+  for (int i=0; i<SUPERVISE_COUNT; ++i)
+  {
+    log("  %-8s %-9s %6u %8u", policies[i].name, healthNames[tasks[i].health], tasks[i].faults, tasks[i].restarts);
+    if (policies[i].critical)
+      log(" %8lu s", (now - tasks[i].lastCheckIn) / 1000);
+    if (tasks[i].health == HEALTH_DOWN)
+      log(" (retry in %ld s)", (long)(tasks[i].retryAt - now) / 1000);
+    log("\r\n");
+  }
+  log(F("  watchdog %s\r\n"), !watchdogRunning ? "off" : watchdogStarving ? "STARVING" : "fed");
+}
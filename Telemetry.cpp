@@ -0,0 +1,55 @@
+#include <Arduino.h>
+#include "BalloonRide.h"
+
+/*
+ * The published telemetry snapshot
+ *
+ * Logging, Iridium, the display, the LED and the scheduler all read one
+ * record, taken once per tick (a mission-time second) from the GPS,
+ * battery, thermal, balloon, landing prediction and modem state.  They
+ * never mix the live structures, which keep changing underneath them.
+ * Each record carries a sequence number.  A consumer that remembers the
+ * last one it used knows whether there's anything new to format.
+ *
+ * There are two buffers.  While the modem is busy, loop() runs again from
+ * inside processIridium() (ISBDCallback).  The outer pass is still holding
+ * its record then.  The nested passes publish only into the other buffer,
+ * so the outer pass's record stays whole until that pass is over.
+ */
+
+static Telemetry buffers[2];
+static int current = 0; // what getTelemetry() returns
+static int outer = 0;   // the outer pass's record: nested passes don't touch it
+static uint32_t sequence = 0;
+
+// Once per loop pass, after the sensors have been read
+void publishTelemetry(bool nested)
+{
+  time_t now = getMissionTime();
+  if (sequence != 0 && now == buffers[current].time)
+    return;
+
+  int next = nested ? 1 - outer : 1 - current;
+  Telemetry &t = buffers[next];
+  const IridiumInfo &iinf = getIridiumInfo();
+  t.time = now;
+  t.gps = getGPSInfo();
+  t.battery = getBatteryInfo();
+  t.thermal = getThermalInfo();
+  t.balloon = getBalloonInfo();
+  t.landing = getLandingInfo();
+  t.iridium.count = iinf.count;
+  t.iridium.failcount = iinf.failcount;
+  t.iridium.xmitTime1 = iinf.xmitTime1;
+  t.iridium.isTransmitting = iinf.isTransmitting;
+  t.sequence = ++sequence;
+
+  current = next;
+  if (!nested)
+    outer = next;
+}
+
+const Telemetry &getTelemetry()
+{
+  return buffers[current];
+}
@@ -1,98 +1,300 @@
 #include <Arduino.h>
+#include <EEPROM.h>
 #include <OneWire.h>    // for DS18B20 thermometer
 #include "BalloonRide.h"
 
 /*
- * Handle the internal and external DS18B20 thermometer modules.
+ * Handle the DS18B20 thermometer modules.
+ *
+ * Any number of probes may share each 1-Wire bus.  Probe 0 (internal) and
+ * probe 1 (external) are the first devices found on buses 0 and 1; any
+ * others (battery, payload, envelope...) follow.  The probe map is kept in
+ * EEPROM so that a reboot doesn't need a ROM search, unless a stored probe
+ * has stopped answering.
+ *
+ * Conversions run in the background: we start every probe on every bus
+ * converting with a single broadcast, go back to the loop, and collect the
+ * results when the conversion time for the configured resolution has passed.
  */
 
+struct ProbeMapEntry
+{
+  byte bus;
+  byte address[8];
+};
+
 static struct ThermalInfo info;
-static OneWire ds[THERMAL_PROBES] = {OneWire(ds18B20pin0), OneWire(ds18B20pin1)};
-static byte thermAddress[THERMAL_PROBES][8];
+static OneWire ds[THERMAL_BUSES] = {OneWire(ds18B20pin0), OneWire(ds18B20pin1)};
+static ProbeMapEntry probes[MAX_THERMAL_PROBES];
+static const uint32_t PROBE_MAP_MAGIC = 0x54485231; // "THR1"
+static bool converting = false;
+static unsigned long conversionStart = 0UL;
+static void startConversion();
 static void readProbeData();
+static bool readScratchpad(int i, byte *data);
+static bool validAddress(const byte *address);
 
-void startThermalProbes()
+// Conversion time in ms for a given DS18B20 resolution (9-12 bits), from the datasheet
+static unsigned long conversionTime(int bits)
 {
-  log(F("Starting thermal probes...\r\n"));
-  displayText(F("Thermal: "));
-  bool fail = false;
-  for (int i=0; i<THERMAL_PROBES; ++i)
+  static const unsigned long times[] = {94, 188, 375, 750};
+  return times[constrain(bits, 9, 12) - 9];
+}
+
+static bool loadProbeMap()
+{
+  if (readEeprom32(EEPROM_PROBE_MAP) != PROBE_MAP_MAGIC)
+    return false;
+
+  int count = EEPROM.read(EEPROM_PROBE_MAP + 4);
+  if (count < THERMAL_BUSES || count > MAX_THERMAL_PROBES)
+    return false;
+
+  int offset = EEPROM_PROBE_MAP + 5;
+  for (int i=0; i<count; ++i)
+  {
+    probes[i].bus = EEPROM.read(offset++);
+    for (int j=0; j<8; ++j)
+      probes[i].address[j] = EEPROM.read(offset++);
+    if (probes[i].bus >= THERMAL_BUSES)
+      return false;
+  }
+  info.probeCount = count;
+  return true;
+}
+
+static void saveProbeMap()
+{
+  writeEeprom32(PROBE_MAP_MAGIC, EEPROM_PROBE_MAP);
+  EEPROM.write(EEPROM_PROBE_MAP + 4, info.probeCount);
+  int offset = EEPROM_PROBE_MAP + 5;
+  for (int i=0; i<info.probeCount; ++i)
+  {
+    EEPROM.write(offset++, probes[i].bus);
+    for (int j=0; j<8; ++j)
+      EEPROM.write(offset++, probes[i].address[j]);
+  }
+}
+
+// Enumerate every device on every bus and rebuild the probe map
+static void searchProbes()
+{
+  memset(probes, 0, sizeof probes);
+  info.probeCount = THERMAL_BUSES; // slots for the first probe on each bus
+  for (int bus=0; bus<THERMAL_BUSES; ++bus)
   {
-    // Device not found?
-    if (!ds[i].search(thermAddress[i]))
+    byte address[8];
+    probes[bus].bus = bus;
+    ds[bus].reset_search();
+    while (ds[bus].search(address))
     {
-      ds[i].reset_search();
-      log("Address search failed for thermal probe %d\r\n", i);
-      fail = true;
-      continue;
+      // Invalid CRC or device not recognized?
+      if (!validAddress(address))
+      {
+        log("Ignoring unknown device on thermal bus %d\r\n", bus);
+        continue;
+      }
+
+      ProbeMapEntry *probe;
+      if (!validAddress(probes[bus].address))
+        probe = &probes[bus];
+      else if (info.probeCount < MAX_THERMAL_PROBES)
+        probe = &probes[info.probeCount++];
+      else
+      {
+        log("Too many thermal probes: ignoring extra device on bus %d\r\n", bus);
+        continue;
+      }
+      probe->bus = bus;
+      memcpy(probe->address, address, 8);
     }
+    ds[bus].reset_search();
+  }
 
-    // Invalid CRC?
-    if (OneWire::crc8(thermAddress[i], 7) != thermAddress[i][7])
+  // Only a complete map is worth keeping; without one the next boot searches again
+  if (validAddress(probes[0].address) && validAddress(probes[1].address))
+    saveProbeMap();
+  else
+    log("Thermal probe missing: probe map not saved\r\n");
+}
+
+// Does every probe in a stored map still answer with a good scratchpad?
+static bool storedProbesAnswer()
+{
+  byte data[9];
+  for (int i=0; i<info.probeCount; ++i)
+  {
+    if (!validAddress(probes[i].address) || !readScratchpad(i, data))
     {
-      log("CRC failed for thermal probe %d\r\n", i);
-      fail = true;
-      continue;
+      log("Stored thermal probe %d doesn't answer\r\n", i);
+      return false;
     }
-  
-    // Device not recognized?
-    if (thermAddress[i][0] != 0x10 && thermAddress[i][0] != 0x28) 
+  }
+  return true;
+}
+
+static bool validAddress(const byte *address)
+{
+  return (address[0] == 0x10 || address[0] == 0x28) && OneWire::crc8(address, 7) == address[7];
+}
+
+// Set resolution on every DS18B20 at once (the older DS18S20 is fixed at 9 bits)
+static void configureProbes()
+{
+  for (int bus=0; bus<THERMAL_BUSES; ++bus)
+  {
+    ds[bus].reset();
+    ds[bus].skip();
+    ds[bus].write(0x4E); // Write Scratchpad: TH, TL, configuration
+    ds[bus].write(0x4B);
+    ds[bus].write(0x46);
+    ds[bus].write(((THERMAL_RESOLUTION - 9) << 5) | 0x1F);
+  }
+  for (int i=0; i<info.probeCount; ++i)
+    info.temperature[i] = INVALID_TEMPERATURE;
+}
+
+void showThermalProbes()
+{
+  for (int i=0; i<info.probeCount; ++i)
+  {
+    log("Probe %d (bus %d) ", i, probes[i].bus);
+    if (!validAddress(probes[i].address))
     {
-      log("Unknown device for thermal probe %d\r\n", i);
-      fail = true;
+      log("not found\r\n");
       continue;
     }
-    
-    log("Probe %d has address ", i);
+    log("has address ");
     for (int j=0; j<8; ++j)
-      log("%02X%c", thermAddress[i][j], j == 7 ? ' ' : ':');
-    log(fail ? "Fail.\r\n" : "OK\r\n");
+      log("%02X%c", probes[i].address[j], j == 7 ? ' ' : ':');
+    log("\r\n");
   }
+}
+
+void startThermalProbes()
+{
+  startupBegin(STARTUP_THERMAL);
+  log(F("Starting thermal probes...\r\n"));
+  displayText(F("Thermal: "));
+
+  if (!loadProbeMap())
+  {
+    log("No stored probe map: searching...\r\n");
+    searchProbes();
+  }
+  else if (!storedProbesAnswer())
+  {
+    log("Stored probe map is out of date: searching...\r\n");
+    searchProbes();
+  }
+  else
+  {
+    log("Loaded %d thermal probes from EEPROM\r\n", info.probeCount);
+  }
+
+  configureProbes();
+  showThermalProbes();
+  bool fail = !validAddress(probes[0].address) || !validAddress(probes[1].address);
   displayText(fail ? "Fail\r\n" : "OK\r\n");
+  startupDone(STARTUP_THERMAL, !fail);
+}
+
+void rescanThermalProbes()
+{
+  converting = false;
+  searchProbes();
+  configureProbes();
+  showThermalProbes();
 }
 
 void processThermalData()
 {
-  static unsigned long lastTimeActive = 0UL; // only really do this once per second
-  if (lastTimeActive == 0UL || millis() - lastTimeActive >= 1000)
+  // Collect the results once the probes have had time to convert...
+  if (converting)
+  {
+    if (millis() - conversionStart >= conversionTime(THERMAL_RESOLUTION))
+    {
+      readProbeData();
+      converting = false;
+    }
+  }
+
+  // ... and start a new conversion once per second
+  else if (conversionStart == 0UL || millis() - conversionStart >= 1000)
+  {
+    startConversion();
+  }
+}
+
+// How many ms until a conversion in progress can be collected
+// (the next one starts on the mission tick anyway)
+unsigned long thermalDeadline()
+{
+  if (!converting)
+    return 0xFFFFFFFFUL;
+  unsigned long elapsed = millis() - conversionStart;
+  unsigned long due = conversionTime(THERMAL_RESOLUTION);
+  return elapsed >= due ? 0UL : due - elapsed;
+}
+
+// Kick off a conversion on every probe at once
+static void startConversion()
+{
+  for (int bus=0; bus<THERMAL_BUSES; ++bus)
   {
-    lastTimeActive = millis();
-    readProbeData();
+    ds[bus].reset();
+    ds[bus].skip();       // address every device on the bus
+    ds[bus].write(0x44, 1); // start conversion, holding the bus high for parasite power
   }
+  conversionStart = millis();
+  converting = true;
+}
+
+// False if the probe doesn't answer or the read fails its CRC
+static bool readScratchpad(int i, byte *data)
+{
+  OneWire &bus = ds[probes[i].bus];
+  if (!bus.reset())
+    return false;
+  bus.select(probes[i].address);
+  bus.write(0xBE); // Read Scratchpad
+
+  for (int j=0; j<9; j++)
+    data[j] = bus.read();
+  return OneWire::crc8(data, 8) == data[8];
 }
 
 static void readProbeData()
 {
-  byte data[12];
-  
-  for (int i=0; i<THERMAL_PROBES; ++i)
+  byte data[9];
+
+  for (int i=0; i<info.probeCount; ++i)
   {
-    if (thermAddress[i][0] != 0x10 && thermAddress[i][0] != 0x28) 
+    if (!validAddress(probes[i].address))
+    {
+      info.temperature[i] = INVALID_TEMPERATURE;
+      continue;
+    }
+
+    // A glitched read is worse than no read at all
+    if (!readScratchpad(i, data))
     {
+      log("Bad read from thermal probe %d\r\n", i);
       info.temperature[i] = INVALID_TEMPERATURE;
       continue;
     }
-    ds[i].reset();
-    ds[i].select(thermAddress[i]);
-    ds[i].write(0x44, 1); // start conversion
-  
-    ds[i].reset();
-    ds[i].select(thermAddress[i]);  
-    ds[i].write(0xBE); // Read Scratchpad
-  
-    for (int j=0; j<9; j++)
-      data[j] = ds[i].read();
-  
-    ds[i].reset_search();
-    
-    // info.temperature[i] = (double)((data[1] << 8) | data[0]) / 16.0;
+
+    // Signed 16-bit value in 1/16 degrees; the DS18S20 reports 1/2 degrees
     int16_t w = (data[1] << 8) | data[0];
-    info.temperature[i] = (double)w / 16.0;
+    if (probes[i].address[0] == 0x10)
+      w <<= 3;
+    else
+      w &= ~((1 << (12 - THERMAL_RESOLUTION)) - 1); // low bits are undefined at lower resolutions
+    info.temperature[i] = w / 16.0f;
   }
 }
 
 const ThermalInfo &getThermalInfo()
 {
   return info;
-}
-
+}
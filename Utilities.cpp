@@ -24,7 +24,7 @@ void writeEeprom32(uint32_t val, int offset)
 }
 
 /*
- * Fatal error: does not return.
+ * Fatal error: does not return.  The watchdog restarts us after a while.
  */
 
 void fatal(int code)
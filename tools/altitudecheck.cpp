@@ -0,0 +1,160 @@
+/*
+ * Host check of the altitude controller (stepAltitudeControl() in Andrew.cpp)
+ * flying a simple balloon
+ *
+ * The balloon's free lift is the speed it would settle at, reached with a
+ * 20 second lag; each second a valve is open moves it by a fixed amount,
+ * helium slowly seeps out, and GPS altitudes carry +-5 m of noise.  Two
+ * flights:
+ *
+ *   settle:  climbing at 5 m/s through 10 km with the target at 12 km, it
+ *            must level off at the target and stay there
+ *   windup:  settled at the target, the balloon warms (+1 m/s of lift) while
+ *            the vent is stuck shut for 15 minutes, so the output sits on its
+ *            limit; the integral must not grow, and once the vent frees it
+ *            must come back without a big undershoot
+ *
+ * Build and run from the top directory:
+ *
+ *   g++ -O2 -std=gnu++14 -Itools/host -I. tools/altitudecheck.cpp Andrew.cpp -o altitudecheck
+ *   ./altitudecheck
+ *
+ * It exits nonzero if any bound is broken.  The gains, duty limit and
+ * shortest pulse are Andrew.cpp's; keep them in step if those change.
+ */
+
+#include <Arduino.h>
+#include <random>
+#include "BalloonRide.h"
+
+// What Andrew.cpp links against; the controller itself touches none of it
+volatile uint32_t ARM_DWT_CYCCNT;
+uint32_t millis() { return 0; }
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+void log(FlashString, ...) {}
+bool executeRemoteCommand(char *) { return true; }
+void recorderTrigger(int) {}
+void startupBegin(int) {}
+void startupDone(int, bool) {}
+const GPSInfo &getGPSInfo() { static GPSInfo info; return info; }
+
+static const float gains[3] = {0.01, 0.3, 0.002}; // Kp, Kv, Ki
+static const float MAX_DUTY = 0.5;
+static const float MIN_PULSE = 0.05;             // s
+
+static const float FIX_INTERVAL = 1.0;           // s
+static const float LAG = 20.0;                   // s for the speed to follow the lift
+static const float VALVE_RATE = 0.05;            // m/s of lift per second open
+static const float LEAK = 0.0005;                // m/s of lift lost per second, to helium seeping out
+static const float NOISE = 5.0;                  // m either way
+static const float STEP = 0.01;                  // s of simulation
+
+struct Balloon
+{
+  double altitude;
+  double speed;
+  double lift;      // m/s the balloon would settle at
+  bool ventStuck;
+};
+
+static std::mt19937 rng(7);
+
+// Fly one fix interval with the valve duty the controller asked for
+static void fly(Balloon &b, float output)
+{
+  float open = fabsf(output) * FIX_INTERVAL;
+  if (open < MIN_PULSE || (output < 0 && b.ventStuck))
+    open = 0;
+  for (float t=0; t<FIX_INTERVAL; t+=STEP)
+  {
+    if (t < open)
+      b.lift += (output > 0 ? VALVE_RATE : -VALVE_RATE) * STEP;
+    b.lift -= LEAK * STEP;
+    b.speed += (b.lift - b.speed) * STEP / LAG;
+    b.altitude += b.speed * STEP;
+  }
+}
+
+static float gpsAltitude(const Balloon &b)
+{
+  return (float)(long)(b.altitude + std::uniform_real_distribution<double>(-NOISE, NOISE)(rng));
+}
+
+static bool failed = false;
+
+static void report(const char *name, const char *what, double worst, double bound)
+{
+  bool ok = worst <= bound;
+  printf("%-8s %-26s %8.3f (bound %g)%s\n", name, what, worst, bound, ok ? "" : "  FAILED");
+  failed = failed || !ok;
+}
+
+static void start(AltitudeControlInfo &c, const Balloon &b, long target)
+{
+  c = AltitudeControlInfo();
+  c.active = true;
+  c.target = target;
+  c.altitude = b.altitude;
+  c.verticalSpeed = b.speed;
+}
+
+int main()
+{
+  // Climbing through 10 km at 5 m/s, told to hold 12 km
+  {
+    Balloon b = {10000, 5, 5, false};
+    AltitudeControlInfo c;
+    start(c, b, 12000);
+    double overshoot = 0, worstError = 0, worstSpeed = 0;
+    for (int fix=0; fix<2 * 3600; ++fix)
+    {
+      stepAltitudeControl(c, gains, gpsAltitude(b), FIX_INTERVAL);
+      fly(b, c.output);
+      overshoot = fmax(overshoot, b.altitude - c.target);
+      if (fix >= 90 * 60) // the last half hour
+      {
+        worstError = fmax(worstError, fabs(b.altitude - c.target));
+        worstSpeed = fmax(worstSpeed, fabs(b.speed));
+      }
+    }
+    report("settle", "overshoot (m)", overshoot, 100);
+    report("settle", "last 30 min error (m)", worstError, 25);
+    report("settle", "last 30 min speed (m/s)", worstSpeed, 0.25);
+  }
+
+  // Settled at 12 km, then warmed with the vent stuck
+  {
+    Balloon b = {12000, 0, 0, false};
+    AltitudeControlInfo c;
+    start(c, b, 12000);
+    for (int fix=0; fix<600; ++fix)
+    {
+      stepAltitudeControl(c, gains, gpsAltitude(b), FIX_INTERVAL);
+      fly(b, c.output);
+    }
+    b.lift += 1.0;
+    b.ventStuck = true;
+    double integral = 0, undershoot = 0, worstError = 0;
+    for (int fix=0; fix<3 * 3600; ++fix)
+    {
+      if (fix == 15 * 60)
+        b.ventStuck = false;
+      stepAltitudeControl(c, gains, gpsAltitude(b), FIX_INTERVAL);
+      fly(b, c.output);
+      if (b.ventStuck)
+        integral = fmax(integral, fabs(gains[2] * c.integral));
+      else
+        undershoot = fmax(undershoot, c.target - b.altitude);
+      if (fix >= 150 * 60)
+        worstError = fmax(worstError, fabs(b.altitude - c.target));
+    }
+    // Unchecked, 15 minutes of the stuck vent winds Ki * integral up past 4 and
+    // the balloon drops 2 km below the target before it recovers
+    report("windup", "Ki * integral while stuck", integral, 2 * MAX_DUTY);
+    report("windup", "undershoot after (m)", undershoot, 200);
+    report("windup", "last 30 min error (m)", worstError, 25);
+  }
+
+  return failed;
+}
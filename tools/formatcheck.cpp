@@ -0,0 +1,161 @@
+/*
+ * Host check of TextWriter (Format.cpp) against the C library's snprintf
+ *
+ * Every conversion TextWriter replaces must come out byte for byte as
+ * snprintf would have written it.  Build and run from the top directory:
+ *
+ *   g++ -O2 -std=gnu++14 -Itools/host -I. tools/formatcheck.cpp Format.cpp -o formatcheck
+ *   ./formatcheck
+ *
+ * It prints the first few mismatches, if any, then how long each way takes
+ * to format "%.2f,%.6f" (a temperature and a position), and exits nonzero
+ * on any mismatch.  The target's newlib rounds the exact binary value half
+ * to even, as glibc does, so agreement here carries over.
+ */
+
+#include <Arduino.h>
+#include <chrono>
+#include <random>
+#include "BalloonRide.h"
+
+volatile uint32_t ARM_DWT_CYCCNT;
+
+static long checks = 0, mismatches = 0;
+static char got[64], want[64];
+
+static void compare(const char *what)
+{
+  ++checks;
+  if (strcmp(got, want) != 0 && ++mismatches <= 10)
+    printf("%s: \"%s\", snprintf \"%s\"\n", what, got, want);
+}
+
+// fixed(value, decimals) vs "%.*f"
+static void checkFloat(float value, int decimals)
+{
+  TextWriter(got).fixed(value, decimals);
+  snprintf(want, sizeof want, "%.*f", decimals, value);
+  char what[48];
+  snprintf(what, sizeof what, "fixed(%a, %d)", value, decimals);
+  compare(what);
+}
+
+// fixed(value, places, decimals) vs "%.*f" of value / 10^places
+static void checkFixed(long value, int places, int decimals)
+{
+  TextWriter(got).fixed(value, places, decimals);
+  double scale = 1;
+  for (int i=0; i<places; ++i)
+    scale *= 10;
+  snprintf(want, sizeof want, "%.*f", decimals, value / scale);
+  char what[48];
+  snprintf(what, sizeof what, "fixed(%ld, %d, %d)", value, places, decimals);
+  compare(what);
+}
+
+static void checkNumber(long value, int width, char pad)
+{
+  TextWriter(got).number(value, width, pad);
+  snprintf(want, sizeof want, pad == '0' ? "%0*ld" : "%*ld", width, value);
+  char what[48];
+  snprintf(what, sizeof what, "number(%ld, %d, '%c')", value, width, pad);
+  compare(what);
+}
+
+static void checkTruncation(const char *s, size_t size)
+{
+  char small[8];
+  TextWriter w(small, size);
+  w.text(s).number(12345);
+  volatile size_t cut = size; // cut short on purpose: keep gcc from warning about it
+  snprintf(want, cut, "%s%d", s, 12345);
+  strcpy(got, small);
+  char what[48];
+  snprintf(what, sizeof what, "truncated to %u", (unsigned)size);
+  compare(what);
+}
+
+static void benchmark(std::mt19937 &rng)
+{
+  static const int RUNS = 2000000;
+  float temperatures[1024];
+  long positions[1024];
+  for (int i=0; i<1024; ++i)
+  {
+    temperatures[i] = (long)(rng() % 200001 - 100000) / 100.0f;
+    positions[i] = (long)(rng() % 3600000001UL) - 1800000000L;
+  }
+
+  volatile size_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i=0; i<RUNS; ++i)
+    sink = sink + snprintf(got, sizeof got, "%.2f,%.6f", temperatures[i & 1023], positions[i & 1023] / 1e7);
+  auto middle = std::chrono::steady_clock::now();
+  for (int i=0; i<RUNS; ++i)
+    sink = sink + TextWriter(got).fixed(temperatures[i & 1023], 2).text(',').fixed(positions[i & 1023], 7, 6).length();
+  auto end = std::chrono::steady_clock::now();
+
+  printf("\"%%.2f,%%.6f\": snprintf %.0f ns, TextWriter %.0f ns per call\n",
+    std::chrono::duration<double, std::nano>(middle - start).count() / RUNS,
+    std::chrono::duration<double, std::nano>(end - middle).count() / RUNS);
+}
+
+int main()
+{
+  std::mt19937 rng(42);
+
+  // Floats from every bit pattern a sensor could plausibly produce
+  for (int i=0; i<3000000; ++i)
+  {
+    uint32_t bits = rng();
+    float value;
+    memcpy(&value, &bits, sizeof value);
+    if (fabsf(value) < 1e7f)
+      checkFloat(value, rng() % 7);
+  }
+  // Short binary fractions, where the ties are
+  for (int i=0; i<1000000; ++i)
+    checkFloat((float)((long)(rng() % 2000001) - 1000000) / (1 << (rng() % 12)), rng() % 4);
+
+  // Positions in 1e-7 degrees, including every tie from -200 to 200 degrees
+  for (int i=0; i<3000000; ++i)
+    checkFixed((long)(rng() % 3600000001UL) - 1800000000L, 7, 6);
+  for (long v=-2000000; v<=2000000; ++v)
+    checkFixed(v * 10 + 5, 7, 6);
+  for (int i=0; i<1000000; ++i)
+  {
+    int places = rng() % 8;
+    checkFixed((long)(rng() % 2000001) - 1000000, places, rng() % (places + 1));
+  }
+
+  for (long v=-1000; v<=1000; ++v)
+    for (int width=0; width<6; ++width)
+    {
+      checkNumber(v, width, ' ');
+      checkNumber(v, width, '0');
+    }
+  checkNumber(-2147483647L - 1, 0, ' ');
+  checkNumber(2147483647L, 12, '0');
+
+  // Positions through coordinate(), and the no-fix sentinel as the old doubles printed it
+  for (int decimals=0; decimals<=7; ++decimals)
+  {
+    TextWriter(got).coordinate(INVALID_LATLONG, decimals);
+    snprintf(want, sizeof want, "%.*f", decimals, -1000.0);
+    compare("coordinate(INVALID_LATLONG)");
+    TextWriter(got).coordinate(-1223153000L, decimals);
+    snprintf(want, sizeof want, "%.*f", decimals, -1223153000L / 1e7);
+    compare("coordinate");
+  }
+
+  TextWriter(got).timestamp(2019, 3, 7, 4, 5, 6);
+  snprintf(want, sizeof want, "%04d-%02d-%02d %02d:%02d:%02d", 2019, 3, 7, 4, 5, 6);
+  compare("timestamp");
+
+  for (size_t size=1; size<=8; ++size)
+    checkTruncation("abc", size);
+
+  printf("%ld checks, %ld mismatches\n", checks, mismatches);
+  benchmark(rng);
+  return mismatches != 0;
+}
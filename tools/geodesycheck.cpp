@@ -0,0 +1,152 @@
+/*
+ * Host check of the single precision geodesy kernels (Geodesy.cpp) against
+ * TinyGPS++'s double precision formulas
+ *
+ * Random position pairs at four spans, from GPS jitter to opposite sides of
+ * the earth, and the worst distance and course errors at each must stay
+ * inside the bounds below.  So must a movePosition() offset, measured back
+ * with the reference, and an odometer's total over a long flight.  Build
+ * and run from the top directory:
+ *
+ *   g++ -O2 -std=gnu++14 -Itools/host -I. tools/geodesycheck.cpp Geodesy.cpp -o geodesycheck
+ *   ./geodesycheck
+ *
+ * It exits nonzero if any bound is broken.  The host's float arithmetic is
+ * IEEE single precision like the M4's, but its libm isn't newlib's, so
+ * leave the bounds some room.
+ */
+
+#include <Arduino.h>
+#include <TinyGPS++.h>
+#include <random>
+#include "BalloonRide.h"
+
+volatile uint32_t ARM_DWT_CYCCNT;
+void log(const char *, ...) {}
+
+static const double EARTH_RADIUS = 6372795;
+static const double DEGREES = 180 / M_PI;
+
+// From TinyGPS++ 1.0
+double TinyGPSPlus::distanceBetween(double lat1, double long1, double lat2, double long2)
+{
+  double delta = (long1 - long2) / DEGREES;
+  double sdlong = sin(delta), cdlong = cos(delta);
+  lat1 /= DEGREES;
+  lat2 /= DEGREES;
+  double slat1 = sin(lat1), clat1 = cos(lat1), slat2 = sin(lat2), clat2 = cos(lat2);
+  delta = (clat1 * slat2) - (slat1 * clat2 * cdlong);
+  delta = delta * delta + (clat2 * sdlong) * (clat2 * sdlong);
+  delta = sqrt(delta);
+  double denom = (slat1 * slat2) + (clat1 * clat2 * cdlong);
+  return atan2(delta, denom) * EARTH_RADIUS;
+}
+
+double TinyGPSPlus::courseTo(double lat1, double long1, double lat2, double long2)
+{
+  double dlon = (long2 - long1) / DEGREES;
+  lat1 /= DEGREES;
+  lat2 /= DEGREES;
+  double a1 = sin(dlon) * cos(lat2);
+  double a2 = cos(lat1) * sin(lat2) - sin(lat1) * cos(lat2) * cos(dlon);
+  a2 = atan2(a1, a2);
+  if (a2 < 0)
+    a2 += 2 * M_PI;
+  return a2 * DEGREES;
+}
+
+static const struct
+{
+  const char *name;
+  long span;          // 1e-7 degrees either way, in latitude and longitude
+  double meters;      // worst distance error allowed
+  double relative;    // of distances over 100 m; a cached cosine can be 0.01 degrees
+                      // of latitude out, tan(lat) * 1.7e-4 or 2e-3 at 85 degrees
+  double degrees;     // worst course error, over 100 m
+} spans[] =
+{
+  {"+-0.001 deg",      10000L,   0.05, 3e-3,  0.01},
+  {"+-0.1 deg",      1000000L,   2.0,  3e-3,  0.1},
+  {"+-0.5 deg",      5000000L,  10.0,  3e-3,  0.5},
+  {"global",      1800000000L, 600.0,  5e-5,  0.5},
+};
+static const int PAIRS = 2000000;
+
+static bool failed = false;
+
+static void report(const char *name, const char *what, double worst, double bound)
+{
+  bool ok = worst <= bound;
+  printf("%-12s %-14s %10.4g (bound %g)%s\n", name, what, worst, bound, ok ? "" : "  FAILED");
+  failed = failed || !ok;
+}
+
+static long wrapLongitude(long lng)
+{
+  return lng > 1800000000L ? lng - 3600000000L : lng < -1800000000L ? lng + 3600000000L : lng;
+}
+
+int main()
+{
+  std::mt19937_64 rng(1);
+
+  for (const auto &s : spans)
+  {
+    double worst = 0, worstRelative = 0, worstCourse = 0;
+    for (int i=0; i<PAIRS; ++i)
+    {
+      long lat1 = (long)(rng() % 1700000001ULL) - 850000000L; // clear of the poles
+      long lng1 = (long)(rng() % 3600000000ULL) - 1800000000L;
+      long lat2 = lat1 + (long)(rng() % (2 * s.span + 1)) - s.span;
+      long lng2 = wrapLongitude(lng1 + (long)(rng() % (2 * s.span + 1)) - s.span);
+      if (labs(lat2) > 850000000L)
+        continue;
+
+      double want = TinyGPSPlus::distanceBetween(lat1 / 1e7, lng1 / 1e7, lat2 / 1e7, lng2 / 1e7);
+      double error = fabs(distanceBetween(lat1, lng1, lat2, lng2) - want);
+      worst = fmax(worst, error);
+      if (want > 100)
+      {
+        worstRelative = fmax(worstRelative, error / want);
+        double course = fabs(courseTo(lat1, lng1, lat2, lng2) - TinyGPSPlus::courseTo(lat1 / 1e7, lng1 / 1e7, lat2 / 1e7, lng2 / 1e7));
+        worstCourse = fmax(worstCourse, course > 180 ? 360 - course : course);
+      }
+    }
+    report(s.name, "distance (m)", worst, s.meters);
+    report(s.name, "relative", worstRelative, s.relative);
+    report(s.name, "course (deg)", worstCourse, s.degrees);
+  }
+
+  // Drift offsets as the landing prediction makes them: up to 200 km
+  double worstMove = 0;
+  for (int i=0; i<PAIRS / 10; ++i)
+  {
+    long lat = (long)(rng() % 1400000001ULL) - 700000000L, lng = (long)(rng() % 3600000000ULL) - 1800000000L;
+    float east = (float)((long)(rng() % 400001) - 200000), north = (float)((long)(rng() % 400001) - 200000);
+    long lat2 = lat, lng2 = lng;
+    movePosition(lat2, lng2, east, north);
+    double want = hypot(east, north);
+    double got = TinyGPSPlus::distanceBetween(lat / 1e7, lng / 1e7, lat2 / 1e7, lng2 / 1e7);
+    if (want > 1000)
+      worstMove = fmax(worstMove, fabs(got - want) / want);
+  }
+  report("movePosition", "relative", worstMove, 0.02);
+
+  // 20,000 km of ~25 m steps eastward along the equator: a float total
+  // comes out kilometers off
+  Odometer odo;
+  double want = 0;
+  long lng = -1800000000L;
+  for (int i=0; i<800000; ++i)
+  {
+    long next = wrapLongitude(lng + 2200 + (long)(rng() % 201));
+    double step = TinyGPSPlus::distanceBetween(0, lng / 1e7, 0, next / 1e7);
+    addToOdometer(odo, 0, next, 20.0f);
+    if (i > 0)
+      want += step;
+    lng = next;
+  }
+  report("odometer", "error (m)", fabs(odo.meters + odo.fraction - want), 10);
+
+  return failed;
+}
@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+"""Host side of the BalloonRide binary ground link (see GroundLink.cpp).
+
+Type BINARY at the console (or pass start=True) to switch the flight computer
+over, then:
+
+    link = GroundLink('/dev/ttyUSB0')
+    print(link.telemetry())
+    link.download(LOG_TELEMETRY, 'telemetry.log')   # picks up where it left off
+    link.command('POWER')
+    link.close()
+
+Needs pyserial.
+"""
+
+import os
+import struct
+import sys
+import zlib
+
+import serial
+
+MSG_TELEMETRY, MSG_LOG_BLOCK, MSG_PROFILE, MSG_COMMAND, MSG_ACK, MSG_TEXT, MSG_EXIT, MSG_DOWNLOAD = range(1, 9)
+LOG_TELEMETRY, LOG_RUNLOG = 2, 4
+PROFILE_SECTIONS = ['GPS', 'thermal', 'battery', 'power', 'logs', 'Iridium', 'LED',
+                    'display', 'console', 'scheduler', 'outputs', 'recorder']
+
+# Mirrors struct TelemetryFrame
+TELEMETRY_FORMAT = '<IiiiHBBBBBBBBIfffffff2fIIBB'
+TELEMETRY_FIELDS = ['missionTime', 'latitude', 'longitude', 'altitude', 'year', 'month', 'day',
+                    'hour', 'minute', 'second', 'satellites', 'fixAcquired', 'flightState',
+                    'fixCount', 'course', 'speed', 'trackDistance', 'batteryVoltage',
+                    'stateOfCharge', 'remainingHours', 'loadMa', 'temperatureInternal',
+                    'temperatureExternal', 'iridiumCount', 'iridiumFailures', 'powerLevel', 'mode']
+BLOCK_SIZE = 512
+
+
+def crc16(data, crc=0xFFFF):
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021 if crc & 0x8000 else crc << 1) & 0xFFFF
+    return crc
+
+
+def cobs_encode(data):
+    out, block = bytearray(), bytearray()
+    for b in data:
+        if b == 0:
+            out += bytes([len(block) + 1]) + block
+            block = bytearray()
+            continue
+        block.append(b)
+        if len(block) == 254:
+            out += b'\xff' + block
+            block = bytearray()
+    return bytes(out + bytes([len(block) + 1]) + block + b'\x00')
+
+
+def cobs_decode(data):
+    out, i = bytearray(), 0
+    while i < len(data):
+        run = data[i]
+        if run == 0 or i + run > len(data):
+            raise ValueError('bad COBS frame')
+        out += data[i + 1:i + run]
+        i += run
+        if run != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+class GroundLink:
+    def __init__(self, port, baud=115200, timeout=2.0, start=False):
+        self.port = serial.Serial(port, baud, timeout=timeout)
+        self.sequence = 0
+        self.text = []  # run log lines that arrived in TEXT frames
+        if start:
+            self.port.write(b'BINARY\r')
+            self.port.read_until(b'binary frames from here on\r\n')
+
+    def send(self, msg_type, payload=b''):
+        self.sequence = (self.sequence + 1) & 0xFF
+        frame = bytes([msg_type, self.sequence]) + payload
+        self.port.write(cobs_encode(frame + struct.pack('<H', crc16(frame))))
+        return self.sequence
+
+    def receive(self):
+        """Next good frame as (type, sequence, payload), or None on timeout."""
+        while True:
+            raw = self.port.read_until(b'\x00')
+            if not raw.endswith(b'\x00'):
+                return None
+            try:
+                frame = cobs_decode(raw[:-1])
+            except ValueError:
+                continue
+            if len(frame) < 4 or crc16(frame[:-2]) != struct.unpack('<H', frame[-2:])[0]:
+                continue
+            if frame[0] == MSG_TEXT:
+                self.text.append(frame[2:-2].decode(errors='replace'))
+                continue
+            return frame[0], frame[1], frame[2:-2]
+
+    def request(self, msg_type, payload=b''):
+        sequence = self.send(msg_type, payload)
+        while True:
+            reply = self.receive()
+            if reply is None:
+                raise TimeoutError('no reply to message type %d' % msg_type)
+            if reply[1] == sequence:
+                return reply
+
+    def telemetry(self, interval_ms=0):
+        """One snapshot; a nonzero interval also starts the stream (see stream())."""
+        msg_type, _, payload = self.request(MSG_TELEMETRY, struct.pack('<H', interval_ms))
+        return self._telemetry(payload)
+
+    def stream(self):
+        while True:
+            reply = self.receive()
+            if reply and reply[0] == MSG_TELEMETRY:
+                yield self._telemetry(reply[2])
+
+    @staticmethod
+    def _telemetry(payload):
+        return dict(zip(TELEMETRY_FIELDS, struct.unpack(TELEMETRY_FORMAT, payload)))
+
+    def read_log_block(self, log, offset, length=BLOCK_SIZE):
+        """Returns (data, file size); data is empty past the end."""
+        msg_type, _, payload = self.request(MSG_LOG_BLOCK, struct.pack('<BIH', log, offset, length))
+        if msg_type != MSG_LOG_BLOCK:
+            raise IOError('log not readable')
+        _, _, size = struct.unpack('<BII', payload[:9])
+        return payload[9:], size
+
+    def download(self, log, path, resume=True, progress=None, retries=10):
+        """Fetch a whole log into path, carrying on from what's already there.
+
+        Blocks are checked against their CRC-32 and offset; after a bad or
+        missing block the download is asked for again from the last good byte,
+        up to `retries` times in a row without progress.  Returns the number
+        of bytes in the file.
+        """
+        offset = os.path.getsize(path) if resume and os.path.exists(path) else 0
+        with open(path, 'ab' if offset else 'wb') as f:
+            failures = 0
+            while failures <= retries:
+                sequence = self.send(MSG_DOWNLOAD, struct.pack('<BI', log, offset))
+                while True:
+                    reply = self.receive()
+                    if reply is None:
+                        break  # timed out: ask again from here
+                    if reply[1] != sequence:
+                        continue
+                    if reply[0] != MSG_DOWNLOAD:
+                        raise IOError('log not readable')
+                    payload = reply[2]
+                    _, block_offset, size, crc = struct.unpack('<BIII', payload[:13])
+                    data = payload[13:]
+                    if block_offset != offset or zlib.crc32(data) != crc:
+                        break
+                    if not data:
+                        return offset
+                    f.write(data)
+                    f.flush()
+                    offset += len(data)
+                    failures = 0
+                    if progress:
+                        progress(offset, size)
+                # cancel whatever is still streaming before asking again
+                self.send(MSG_DOWNLOAD, b'\x00')
+                self.port.reset_input_buffer()
+                failures += 1
+        raise TimeoutError('download stalled at offset %d' % offset)
+
+    def profile(self):
+        _, _, payload = self.request(MSG_PROFILE)
+        values = struct.unpack('<%dI' % (len(payload) // 4), payload)
+        return values[0], {name: (values[1 + 2 * i], values[2 + 2 * i])
+                           for i, name in enumerate(PROFILE_SECTIONS)}
+
+    def command(self, text):
+        _, _, payload = self.request(MSG_COMMAND, text.encode())
+        return bool(payload[0])
+
+    def close(self):
+        self.request(MSG_EXIT)
+        self.port.close()
+
+
+if __name__ == '__main__':
+    link = GroundLink(sys.argv[1] if len(sys.argv) > 1 else '/dev/ttyUSB0', start=True)
+    for name, value in link.telemetry().items():
+        print('%-20s %s' % (name, value))
+    link.close()
@@ -0,0 +1,40 @@
+/*
+ * Just enough of the Teensy core to build the hardware-free modules
+ * (Format.cpp, Geodesy.cpp), the controller in Andrew.cpp and the flight
+ * recorder on a PC for the checks in tools/
+ */
+
+#pragma once
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define __MK64FX512__ 1 // BalloonRide.h insists
+#define PROGMEM
+#define F(s) ((const __FlashStringHelper *)(s))
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+typedef uint8_t byte;
+class __FlashStringHelper;
+class HardwareSerial;
+static const int A9 = 23;
+extern volatile uint32_t ARM_DWT_CYCCNT; // the checks define it
+extern uint32_t millis();                 // and these, where they need them
+extern void pinMode(uint8_t pin, uint8_t mode);
+extern void digitalWrite(uint8_t pin, uint8_t value);
+
+template<typename A, typename B> A min(A a, B b)
+{
+  return b < a ? b : a;
+}
+
+template<typename T, typename L, typename H> T constrain(T x, L lo, H hi)
+{
+  return x < lo ? lo : x > hi ? hi : x;
+}
@@ -0,0 +1,20 @@
+/*
+ * The corner of SdFat the flight recorder (Recorder.cpp) writes its
+ * captures through.  tools/recordercheck.cpp defines the methods.
+ */
+
+#pragma once
+#include <stddef.h>
+
+#define O_READ 0x01
+#define O_WRITE 0x02
+#define O_CREAT 0x10
+#define O_TRUNC 0x40
+
+class File
+{
+public:
+  bool open(const char *path, int flags);
+  int write(const void *data, size_t size);
+  bool close();
+};
@@ -0,0 +1,14 @@
+/*
+ * The two TinyGPS++ functions Geodesy.cpp refers to.  tools/geodesycheck.cpp
+ * defines them with the library's own double precision formulas and uses
+ * them as the reference.
+ */
+
+#pragma once
+
+class TinyGPSPlus
+{
+public:
+  static double distanceBetween(double lat1, double long1, double lat2, double long2);
+  static double courseTo(double lat1, double long1, double lat2, double long2);
+};
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""Static RAM per module, from the linker map of a BalloonRide build.
+
+The firmware's MEMORY command only knows the totals (and the stack).  This
+breaks data, noinit and bss down by the object file they came from:
+
+    python3 tools/rambudget.py BalloonRide.map
+
+To get a map, link with -Wl,-Map=BalloonRide.map (for instance by adding it
+to build.flags.ld in a boards.local.txt next to Teensyduino's boards.txt).
+"""
+
+import os
+import re
+import sys
+from collections import defaultdict
+
+RAM_SIZE = 256 * 1024  # Teensy 3.5
+COLUMNS = ['data', 'noinit', 'bss']
+OUTPUT_SECTIONS = {'.data': 'data', '.noinit': 'noinit', '.bss': 'bss',
+                   # the core's NOLOAD buffers, ahead of .data
+                   '.usbdescriptortable': 'noinit', '.dmabuffers': 'noinit', '.usbbuffers': 'noinit'}
+
+# Input section lines: " .bss.info  0x1fff8a10  0x5c  path/GPS.cpp.o", possibly with
+# the name alone on one line and the rest on the next
+INPUT = re.compile(r'^ (\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+OUTPUT = re.compile(r'^(\.\S+)(\s+0x[0-9a-fA-F]+\s+0x[0-9a-fA-F]+)?')
+
+
+def module_name(path):
+    """GPS.cpp.o -> GPS.cpp; libcore.a(usb_dev.c.o) -> core:usb_dev.c"""
+    path = path.strip()
+    archive = re.match(r'(.*)\((.*)\)$', path)
+    if archive:
+        lib = os.path.basename(archive.group(1))
+        lib = re.sub(r'^lib|\.a$', '', lib)
+        return '%s:%s' % (lib, re.sub(r'\.o$', '', archive.group(2)))
+    return re.sub(r'\.o$', '', os.path.basename(path))
+
+
+def parse(lines):
+    usage = defaultdict(lambda: defaultdict(int))
+    column = None
+    pending = None  # input section name waiting for its address line
+    for line in lines:
+        line = line.rstrip('\n')
+        if line.startswith('.'):
+            name = OUTPUT.match(line).group(1)
+            column = OUTPUT_SECTIONS.get(name)
+            continue
+        if column is None or line.startswith(' *') or '*fill*' in line:
+            pending = None
+            continue
+        m = INPUT.match(line)
+        if m and (m.group(1) or pending):
+            size = int(m.group(3), 16)
+            if size:
+                usage[module_name(m.group(4))][column] += size
+            pending = None
+        elif re.match(r'^ \S+$', line):
+            pending = line.strip()
+    return usage
+
+
+def report(usage, out=sys.stdout):
+    totals = defaultdict(int)
+    rows = sorted(usage.items(), key=lambda kv: -sum(kv[1].values()))
+    out.write('%-32s %7s %7s %7s %7s\n' % ('module', 'data', 'noinit', 'bss', 'total'))
+    for module, sizes in rows:
+        for c in COLUMNS:
+            totals[c] += sizes[c]
+        out.write('%-32s %7d %7d %7d %7d\n' % ((module,) + tuple(sizes[c] for c in COLUMNS) + (sum(sizes.values()),)))
+    total = sum(totals.values())
+    out.write('%-32s %7d %7d %7d %7d\n' % (('total',) + tuple(totals[c] for c in COLUMNS) + (total,)))
+    out.write('%d of %d bytes of RAM (%.1f%%) before heap and stack\n' % (total, RAM_SIZE, 100.0 * total / RAM_SIZE))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    with open(sys.argv[1]) as f:
+        report(parse(f))
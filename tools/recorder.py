@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+"""CSV from a flight recorder capture (burst1.rec, landing2.rec, ...; see Recorder.cpp).
+
+    python3 tools/recorder.py landing2.rec > landing2.csv
+
+Time is in seconds from the trigger, so the rows before it are negative.
+"""
+
+import struct
+import sys
+
+# Mirror struct CaptureHeader and struct Sample
+HEADER_FORMAT = '<4sHHHBBI'
+SAMPLE_FORMAT = '<IiiihhhHHBB'
+TRIGGERS = ['manual', 'cutdown', 'burst', 'descent', 'landing']
+FLAGS = [(1, 'fix'), (2, 'stale'), (4, 'flying')]
+INVALID_CENTIDEGREES = -32768
+
+
+def samples(data):
+    magic, size, count, trigger_sample, trigger, _, trigger_ms = struct.unpack_from(HEADER_FORMAT, data)
+    if magic != b'BRFR':
+        raise ValueError('not a flight recorder capture')
+    if size != struct.calcsize(SAMPLE_FORMAT):
+        raise ValueError('sample size %d, expected %d' % (size, struct.calcsize(SAMPLE_FORMAT)))
+    offset = struct.calcsize(HEADER_FORMAT)
+    rows = []
+    for i in range(count):
+        rows.append(struct.unpack_from(SAMPLE_FORMAT, data, offset + i * size))
+    name = TRIGGERS[trigger] if trigger < len(TRIGGERS) else str(trigger)
+    return name, trigger_sample, trigger_ms, rows
+
+
+def degrees(centi):
+    return '' if centi == INVALID_CENTIDEGREES else '%.2f' % (centi / 100.0)
+
+
+def main(path, out=sys.stdout):
+    with open(path, 'rb') as f:
+        name, trigger_sample, trigger_ms, rows = samples(f.read())
+    out.write('# %s trigger at %d ms, sample %d of %d\n' % (name, trigger_ms, trigger_sample, len(rows)))
+    out.write('t,latitude,longitude,altitude,vertical_speed,t_int,t_ext,battery,speed,satellites,flags\n')
+    for ms, lat, lng, alt, vs, t_int, t_ext, mv, speed, sats, flags in rows:
+        out.write('%.1f,%.7f,%.7f,%d,%.2f,%s,%s,%.3f,%.2f,%d,%s\n' % (
+            (ms - trigger_ms) / 1000.0, lat / 1e7, lng / 1e7, alt, vs / 100.0, degrees(t_int), degrees(t_ext),
+            mv / 1000.0, speed / 100.0, sats, '|'.join(n for bit, n in FLAGS if flags & bit)))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    main(sys.argv[1])
@@ -0,0 +1,235 @@
+/*
+ * Host check of the flight recorder's triggers (Recorder.cpp) over two
+ * simulated flights, fed 2 fixes a second
+ *
+ *   burst:    up at 5 m/s to 30 km and straight back down, falling at 5 m/s
+ *             at the ground and faster with height, to land at 300 m
+ *   descent:  up to 30 km, an hour afloat, a slow leak down to 25 km and
+ *             then the fall: 5 km under the top, so "descent", not "burst"
+ *
+ * Both climbs carry a run of DESCENT_SAMPLES - 1 wild fixes every five
+ * minutes, which mustn't trigger anything, and the float mustn't look like
+ * a landing.  Each flight must fire its fall trigger on the fall's
+ * DESCENT_SAMPLES'th fix and the landing STILL_MS after the last moving
+ * fix, and nothing else, and leave captures with the trigger sample where
+ * tools/recorder.py will look for it.  Build and run from the top
+ * directory:
+ *
+ *   g++ -O2 -std=gnu++14 -Itools/host -I. tools/recordercheck.cpp Recorder.cpp -o recordercheck
+ *   ./recordercheck
+ *
+ * The captures are left in the current directory as burst-burst1.rec and
+ * so on.  It exits nonzero if any check fails.
+ */
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include <random>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "BalloonRide.h"
+
+// Recorder.cpp's, for the checks
+static const int PRE_SAMPLES = 240;
+static const int POST_SAMPLES = 240;
+static const int DESCENT_SAMPLES = 4;
+static const float STILL_MS = 20000;
+static const char *triggerNames[TRIGGER_COUNT] = {"manual", "cutdown", "burst", "descent", "landing"};
+
+static const unsigned long FIX_MS = 500;
+static const double GROUND = 300;       // m
+static const double CEILING = 30000;
+static const double CLIMB = 5;          // m/s
+static const double LEAK = 1;           // m/s down while afloat and leaking
+static const float NOISE = 0.5;         // m/s either way on the vertical speed
+
+// The world Recorder.cpp sees
+static uint32_t now = 0;
+static GPSInfo gps;
+static BalloonInfo balloon;
+static ThermalInfo thermal;
+static BatteryInfo battery;
+static ModeProfile mode = {};
+static const char *flightName;
+static unsigned long firedMs[TRIGGER_COUNT];
+static int firedCount[TRIGGER_COUNT];
+
+uint32_t millis() { return now; }
+const GPSInfo &getGPSInfo() { return gps; }
+const BalloonInfo &getBalloonInfo() { return balloon; }
+const ThermalInfo &getThermalInfo() { return thermal; }
+const BatteryInfo &getBatteryInfo() { return battery; }
+const ModeProfile &getModeProfile() { return mode; }
+bool powerThrottled(int) { return false; }
+void setGPSFastFixes(bool) {}
+bool SDFail() { return false; }
+void log(FlashString, ...) {}
+void log(const char *, ...) {}
+
+void trace(uint8_t type, uint8_t code, int32_t)
+{
+  if (type == TRACE_CAPTURE && code < TRIGGER_COUNT && firedCount[code]++ == 0)
+    firedMs[code] = now;
+}
+
+// Captures go to the current directory, named for the flight
+static FILE *capture;
+
+bool File::open(const char *path, int)
+{
+  char name[64];
+  snprintf(name, sizeof name, "%s-%s", flightName, path);
+  capture = fopen(name, "wb");
+  return capture != NULL;
+}
+
+int File::write(const void *data, size_t size)
+{
+  return (int)fwrite(data, 1, size, capture);
+}
+
+bool File::close()
+{
+  return fclose(capture) == 0;
+}
+
+static bool failed = false;
+
+static void report(const char *what, double value, double low, double high)
+{
+  bool ok = value >= low && value <= high;
+  printf("%-8s %-28s %9.1f (%g to %g)%s\n", flightName, what, value, low, high, ok ? "" : "  FAILED");
+  failed = failed || !ok;
+}
+
+// The header and trigger sample of a capture, as tools/recorder.py reads them
+static void checkCapture(int trigger, int number)
+{
+  char name[64], what[96];
+  snprintf(name, sizeof name, "%s-%s%d.rec", flightName, triggerNames[trigger], number);
+  FILE *f = fopen(name, "rb");
+  uint8_t data[16 + 64 * (PRE_SAMPLES + POST_SAMPLES)];
+  size_t size = f ? fread(data, 1, sizeof data, f) : 0;
+  if (f)
+    fclose(f);
+  uint16_t sampleSize, samples, triggerSample;
+  uint32_t triggerMs, sampleMs = 0;
+  memcpy(&sampleSize, data + 4, 2);
+  memcpy(&samples, data + 6, 2);
+  memcpy(&triggerSample, data + 8, 2);
+  memcpy(&triggerMs, data + 12, 4);
+  bool ok = size >= 16 && memcmp(data, "BRFR", 4) == 0 && data[10] == trigger &&
+    size == 16 + (size_t)sampleSize * samples && triggerSample < samples;
+  if (ok)
+    memcpy(&sampleMs, data + 16 + triggerSample * sampleSize, 4);
+  snprintf(what, sizeof what, "%s capture readable", triggerNames[trigger]);
+  report(what, ok, 1, 1);
+  snprintf(what, sizeof what, "%s samples", triggerNames[trigger]);
+  report(what, ok ? samples : 0, PRE_SAMPLES + POST_SAMPLES, PRE_SAMPLES + POST_SAMPLES);
+  snprintf(what, sizeof what, "%s trigger sample (ms)", triggerNames[trigger]);
+  report(what, ok ? (double)sampleMs - triggerMs : -1, 0, 0);
+}
+
+static void fly(const char *name, double floatSeconds, double fallFrom, int fallTrigger)
+{
+  flightName = name;
+  balloon.flightState = BalloonInfo::INFLIGHT;
+  thermal.temperature[0] = 20;
+  thermal.temperature[1] = INVALID_TEMPERATURE;
+  battery.batteryVoltage = 3.9;
+  gps.latitude = 473000000L;
+  gps.longitude = -1223000000L;
+  gps.satellites = 9;
+  gps.fixAcquired = true;
+
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<float> noise(-NOISE, NOISE);
+  enum { CLIMBING, AFLOAT, LEAKING, FALLING, LANDED } phase = CLIMBING;
+  double altitude = GROUND, afloatUntil = 0;
+  unsigned long fallMs = 0, movingMs = 0, landedMs = 0;
+  for (int fix=0; phase != LANDED || now - landedMs < 5 * 60000UL; ++fix)
+  {
+    now += FIX_MS;
+    double speed = 0;
+    switch (phase)
+    {
+      case CLIMBING:
+        speed = CLIMB;
+        if (altitude >= CEILING)
+        {
+          phase = floatSeconds > 0 ? AFLOAT : FALLING;
+          afloatUntil = now / 1000.0 + floatSeconds;
+          fallMs = now;
+        }
+        break;
+      case AFLOAT:
+        if (now / 1000.0 >= afloatUntil)
+          phase = LEAKING;
+        break;
+      case LEAKING:
+        speed = -LEAK;
+        if (altitude <= fallFrom)
+        {
+          phase = FALLING;
+          fallMs = now;
+        }
+        break;
+      case FALLING:
+        speed = -5 * exp((altitude - GROUND) / 14000); // thinner air, faster fall
+        if (altitude <= GROUND)
+        {
+          phase = LANDED;
+          landedMs = now;
+          speed = 0;
+        }
+        else
+          movingMs = now;
+        break;
+      case LANDED:
+        break;
+    }
+    if (phase != LANDED)
+      altitude = fmax(GROUND, altitude + speed * FIX_MS / 1000);
+
+    gps.altitude = (long)altitude;
+    gps.verticalSpeed = speed + noise(rng);
+    if (phase == CLIMBING && fix % 600 < DESCENT_SAMPLES - 1)
+      gps.verticalSpeed = -30; // a few wild fixes
+    ++gps.fixCount;
+    processRecorder();
+  }
+
+  double fell = DESCENT_SAMPLES * FIX_MS / 1000.0;
+  report("fall trigger delay (s)", firedCount[fallTrigger] ? (long)(firedMs[fallTrigger] - fallMs) / 1000.0 : -1, fell, fell);
+  report("landing delay (s)", firedCount[TRIGGER_LANDING] ? (long)(firedMs[TRIGGER_LANDING] - movingMs) / 1000.0 : -1,
+    STILL_MS / 1000, (STILL_MS + FIX_MS) / 1000);
+  int others = 0;
+  for (int i=0; i<TRIGGER_COUNT; ++i)
+    if (i != fallTrigger && i != TRIGGER_LANDING)
+      others += firedCount[i];
+  report("other triggers", others, 0, 0);
+  checkCapture(fallTrigger, 1);
+  checkCapture(TRIGGER_LANDING, 2);
+}
+
+// Each flight in a child of its own, so Recorder.cpp's state starts fresh
+static bool flight(const char *name, double floatSeconds, double fallFrom, int fallTrigger)
+{
+  fflush(stdout);
+  pid_t child = fork();
+  if (child == 0)
+  {
+    fly(name, floatSeconds, fallFrom, fallTrigger);
+    fflush(stdout);
+    _exit(failed);
+  }
+  int status;
+  return child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main()
+{
+  bool ok = flight("burst", 0, CEILING, TRIGGER_BURST);
+  ok = flight("descent", 3600, 25000, TRIGGER_DESCENT) && ok;
+  return !ok;
+}